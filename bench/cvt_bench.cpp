@@ -0,0 +1,440 @@
+/* Benchmark of the CVT pipeline on procedural meshes.
+
+   Build from the repository root:
+       g++ -O2 -std=c++17 -pthread -Ilibcvt bench/cvt_bench.cpp -o cvt_bench
+
+   Every mesh of every shape and size is written to and read back from an
+   OFF file, built as an A48::Mesh both face by face with put_face and
+   link_mesh ("put_face_build") and at once with Mesh::build
+   ("mesh_build"), built as a CompactMesh, and segmented for
+   every number of regions; each phase is timed on its own and the runs
+   are printed as JSON on stdout, one run per line inside "runs", so that
+   two outputs can be compared against each other or a stored baseline.
+   "kernels" then times each face-to-patch energy kernel the cpu supports
+   (scalar, sse2, avx2, avx512) against the scalar one, per shape, size
+   and number of regions, and counts the faces where its result differs.
+
+   Options, lists are comma separated:
+       --shapes icosphere,torus,heightfield
+       --faces 10000,100000,1000000     approximate, shapes round them
+       --regions 100,1000
+       --threads 1,4                    0 for all cores
+       --iterations 20                  Lloyd iterations per run
+       --seed 0
+       --tmp cvt_bench.off              scratch OFF file
+*/
+
+#include <cfloat>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "cvt.h"
+
+using namespace libcvd;
+
+namespace {
+
+	// M_PI is not standard C++
+	const double PI = 3.14159265358979323846;
+
+	struct Options {
+		std::vector<std::string> shapes;
+		std::vector<int> faces, regions, threads;
+		int iterations;
+		unsigned long long seed;
+		std::string tmp;
+
+		Options() : iterations(20), seed(0), tmp("cvt_bench.off")
+		{
+			shapes.push_back("icosphere"); shapes.push_back("torus"); shapes.push_back("heightfield");
+			faces.push_back(10000); faces.push_back(100000);
+			regions.push_back(100); regions.push_back(1000);
+			threads.push_back(1);
+		}
+	};
+
+	// flat triangle mesh as the pipeline takes it
+	struct BenchMesh {
+		std::vector<double> positions;
+		std::vector<int> tris;
+
+		int num_verts() const { return (int)positions.size() / 3; }
+		int num_faces() const { return (int)tris.size() / 3; }
+		void add_vertex(double x, double y, double z) { positions.push_back(x); positions.push_back(y); positions.push_back(z); }
+		void add_face(int a, int b, int c) { tris.push_back(a); tris.push_back(b); tris.push_back(c); }
+	};
+
+	class Timer {
+	public:
+		Timer() : start_(std::chrono::steady_clock::now()) {}
+		double ms() const { return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_).count(); }
+	private:
+		std::chrono::steady_clock::time_point start_;
+	};
+
+	/* Icosahedron split 4-to-1 until it has at least about faces / 2
+	   triangles, with new vertices pushed out to the unit sphere. */
+	void make_icosphere(BenchMesh& m, int faces)
+	{
+		const double t = (1 + sqrt(5.0)) / 2;
+		double v[12][3] = { {-1,t,0}, {1,t,0}, {-1,-t,0}, {1,-t,0}, {0,-1,t}, {0,1,t},
+			{0,-1,-t}, {0,1,-t}, {t,0,-1}, {t,0,1}, {-t,0,-1}, {-t,0,1} };
+		int f[20][3] = { {0,11,5}, {0,5,1}, {0,1,7}, {0,7,10}, {0,10,11}, {1,5,9}, {5,11,4},
+			{11,10,2}, {10,7,6}, {7,1,8}, {3,9,4}, {3,4,2}, {3,2,6}, {3,6,8}, {3,8,9},
+			{4,9,5}, {2,4,11}, {6,2,10}, {8,6,7}, {9,8,1} };
+
+		m = BenchMesh();
+		for (int i = 0; i < 12; i++)
+		{
+			double n = sqrt(v[i][0]*v[i][0] + v[i][1]*v[i][1] + v[i][2]*v[i][2]);
+			m.add_vertex(v[i][0] / n, v[i][1] / n, v[i][2] / n);
+		}
+		for (int i = 0; i < 20; i++)
+			m.add_face(f[i][0], f[i][1], f[i][2]);
+
+		while (2 * m.num_faces() < faces)
+		{
+			std::unordered_map<unsigned long long, int> midpoint;
+			midpoint.reserve(3 * m.num_faces() / 2);
+			auto split = [&](int a, int b) {
+				unsigned long long key = (a < b) ? ((unsigned long long)a << 32) | b : ((unsigned long long)b << 32) | a;
+				std::unordered_map<unsigned long long, int>::iterator it = midpoint.find(key);
+				if (it != midpoint.end())
+					return it->second;
+				double x = m.positions[3*a] + m.positions[3*b];
+				double y = m.positions[3*a + 1] + m.positions[3*b + 1];
+				double z = m.positions[3*a + 2] + m.positions[3*b + 2];
+				double n = sqrt(x*x + y*y + z*z);
+				int i = m.num_verts();
+				m.add_vertex(x / n, y / n, z / n);
+				midpoint[key] = i;
+				return i;
+			};
+
+			std::vector<int> old;
+			old.swap(m.tris);
+			for (size_t i = 0; i < old.size(); i += 3)
+			{
+				int a = old[i], b = old[i+1], c = old[i+2];
+				int ab = split(a, b), bc = split(b, c), ca = split(c, a);
+				m.add_face(a, ab, ca);
+				m.add_face(b, bc, ab);
+				m.add_face(c, ca, bc);
+				m.add_face(ab, bc, ca);
+			}
+		}
+	}
+
+	// torus of radii 3 and 1 on a u by v grid, 2uv faces
+	void make_torus(BenchMesh& m, int faces)
+	{
+		int u = std::max(3, (int)sqrt(faces * 1.5));
+		int v = std::max(3, faces / (2 * u));
+		m = BenchMesh();
+		for (int i = 0; i < u; i++)
+			for (int j = 0; j < v; j++)
+			{
+				double a = 2 * PI * i / u, b = 2 * PI * j / v;
+				m.add_vertex((3 + cos(b)) * cos(a), (3 + cos(b)) * sin(a), sin(b));
+			}
+		for (int i = 0; i < u; i++)
+			for (int j = 0; j < v; j++)
+			{
+				int a = i * v + j, b = ((i + 1) % u) * v + j;
+				int c = ((i + 1) % u) * v + (j + 1) % v, d = i * v + (j + 1) % v;
+				m.add_face(a, b, c);
+				m.add_face(a, c, d);
+			}
+	}
+
+	// open n by n grid on the unit square with smooth relief and noise
+	void make_heightfield(BenchMesh& m, int faces, unsigned long long seed)
+	{
+		int n = std::max(2, (int)sqrt(faces / 2.0));
+		Rng rng(seed);
+		m = BenchMesh();
+		for (int i = 0; i <= n; i++)
+			for (int j = 0; j <= n; j++)
+			{
+				double x = (double)i / n, y = (double)j / n;
+				double z = 0.1 * sin(6 * x) * cos(4 * y) + 0.05 * sin(17 * x + 5 * y)
+					+ 0.2 / n * (rng.next_uniform() - 0.5);
+				m.add_vertex(x, y, z);
+			}
+		for (int i = 0; i < n; i++)
+			for (int j = 0; j < n; j++)
+			{
+				int a = i * (n + 1) + j, b = a + n + 1;
+				m.add_face(a, b, b + 1);
+				m.add_face(a, b + 1, a + 1);
+			}
+	}
+
+	bool make_shape(const std::string& shape, int faces, unsigned long long seed, BenchMesh& m)
+	{
+		if (shape == "icosphere") make_icosphere(m, faces);
+		else if (shape == "torus") make_torus(m, faces);
+		else if (shape == "heightfield") make_heightfield(m, faces, seed);
+		else return false;
+		return true;
+	}
+
+	// the figures of the last update are only visible to subclasses
+	class BenchCvd : public LloydCvd {
+	public:
+		BenchCvd(CompactMesh* mesh) : LloydCvd(mesh) {}
+		double energy() const { return region_energy; }
+		long long evaluations() const { return energy_evaluations; }
+	};
+
+	struct IoTimes {
+		double write_off, load_off, put_face_build, mesh_build, compact_build;
+	};
+
+	IoTimes time_io(const BenchMesh& m, int threads, const std::string& tmp)
+	{
+		IoTimes t;
+		Timer w;
+		write_off(tmp, m.positions.data(), m.num_verts(), NULL, m.tris.data(), m.num_faces(), NULL, 6, threads);
+		t.write_off = w.ms();
+
+		OffData off;
+		Timer l;
+		load_off(tmp, off, threads);
+		t.load_off = l.ms();
+		remove(tmp.c_str());
+
+		auto add_vertices = [&](Mesh& mesh, std::vector<Vertex*>& verts) {
+			mesh.reserve(m.num_verts(), 0, 0);
+			verts.resize(m.num_verts());
+			for (int i = 0; i < m.num_verts(); i++)
+			{
+				verts[i] = mesh.new_vertex();
+				verts[i]->a = Point(m.positions[3*i], m.positions[3*i + 1], m.positions[3*i + 2]);
+				verts[i]->index = i;
+			}
+		};
+
+		{
+			// the construction path from before Mesh::build
+			Timer b;
+			Mesh mesh;
+			std::vector<Vertex*> verts;
+			add_vertices(mesh, verts);
+			HedgeMap hedges;
+			for (int f = 0; f < m.num_faces(); f++)
+				mesh.put_face(m.tris[3*f], m.tris[3*f + 1], m.tris[3*f + 2], verts.data(), &hedges);
+			mesh.link_mesh();
+			t.put_face_build = b.ms();
+		}
+
+		{
+			ThreadPool pool(threads);
+			Timer b;
+			Mesh mesh;
+			std::vector<Vertex*> verts;
+			add_vertices(mesh, verts);
+			mesh.build(verts.data(), m.num_verts(), m.tris.data(), m.num_faces(), &pool);
+			t.mesh_build = b.ms();
+		}
+
+		{
+			ThreadPool pool(threads);
+			Timer b;
+			CompactMesh mesh;
+			mesh.build(m.positions.data(), m.num_verts(), m.tris.data(), m.num_faces(), &pool);
+			t.compact_build = b.ms();
+		}
+		return t;
+	}
+
+	void run(const std::string& shape, const BenchMesh& m, const IoTimes& io, int regions, int threads,
+		const Options& opt, bool first)
+	{
+		CompactMesh mesh;
+		{
+			ThreadPool pool(threads);
+			mesh.build(m.positions.data(), m.num_verts(), m.tris.data(), m.num_faces(), &pool);
+		}
+
+		BenchCvd cvd(&mesh);
+		cvd.set_num_threads(threads);
+		cvd.rng = Rng(opt.seed);
+
+		Timer ti;
+		cvd.initialize_centroids(&mesh, regions);
+		double init = ti.ms();
+
+		double regions_ms = 0, centroids_ms = 0;
+		int reassigned = 0;
+		long long evaluations = 0;
+		for (int i = 0; i < opt.iterations; i++)
+		{
+			Timer tr;
+			reassigned = cvd.update_regions(NULL);
+			regions_ms += tr.ms();
+			evaluations += cvd.evaluations();
+			Timer tc;
+			cvd.update_centroids(NULL);
+			centroids_ms += tc.ms();
+		}
+
+		printf("%s    {\"shape\": \"%s\", \"vertices\": %d, \"faces\": %d, \"regions\": %d, \"threads\": %d, \"iterations\": %d,\n"
+			"     \"ms\": {\"write_off\": %.3f, \"load_off\": %.3f, \"put_face_build\": %.3f, \"mesh_build\": %.3f, \"compact_build\": %.3f, "
+			"\"initialize_centroids\": %.3f, \"update_regions\": %.3f, \"update_centroids\": %.3f},\n"
+			"     \"energy\": %.17g, \"last_reassigned\": %d, \"energy_evaluations\": %lld}",
+			first ? "" : ",\n", shape.c_str(), m.num_verts(), m.num_faces(), regions, threads, opt.iterations,
+			io.write_off, io.load_off, io.put_face_build, io.mesh_build, io.compact_build,
+			init, regions_ms, centroids_ms, cvd.energy(), reassigned, evaluations);
+		fflush(stdout);
+	}
+
+	/* Every energy kernel the cpu runs, scanning all faces against the
+	   given number of patches with alpha 1/2; the times are per scan and
+	   each kernel is checked against the scalar one, face by face. */
+	void time_kernels(const std::string& shape, const BenchMesh& m, int regions, const Options& opt,
+		std::vector<std::string>& out)
+	{
+		CompactMesh mesh;
+		mesh.build(m.positions.data(), m.num_verts(), m.tris.data(), m.num_faces());
+		FaceBuffers faces;
+		faces.build(mesh);
+		int nf = faces.size();
+		int np = std::min(regions, nf);
+
+		PatchBuffers patches;
+		patches.resize(np);
+		Rng rng(opt.seed);
+		for (int i = 0; i < np; i++)
+		{
+			int j = (int)(rng.uniform(i) * nf);
+			patches.cx[i] = faces.cx[j]; patches.cy[i] = faces.cy[j]; patches.cz[i] = faces.cz[j];
+			patches.nx[i] = faces.nx[j]; patches.ny[i] = faces.ny[j]; patches.nz[i] = faces.nz[j];
+		}
+		const double* p[6] = { patches.cx.data(), patches.cy.data(), patches.cz.data(),
+			patches.nx.data(), patches.ny.data(), patches.nz.data() };
+		double wc = 0.5 * 2.0 / MeshGeometry::get_diameter(mesh), wn = 0.5;
+
+		std::vector<ArgminEnergyFn> kernels(1, &argmin_energy_scalar);
+#ifdef A48_X86
+		if (cpu_has("sse2")) kernels.push_back(&argmin_energy_sse2);
+		if (cpu_has("avx2")) kernels.push_back(&argmin_energy_avx2);
+		if (cpu_has("avx512f")) kernels.push_back(&argmin_energy_avx512);
+#endif
+
+		int reps = std::max(1, (int)(2e7 / ((double)nf * np)));
+		std::vector<int> best(nf), scalar_best(nf);
+		std::vector<double> energy(nf), scalar_energy(nf);
+		double scalar_ms = 0;
+		for (size_t k = 0; k < kernels.size(); k++)
+		{
+			Timer t;
+			for (int r = 0; r < reps; r++)
+				for (int i = 0; i < nf; i++)
+				{
+					double f[6] = { faces.cx[i], faces.cy[i], faces.cz[i], faces.nx[i], faces.ny[i], faces.nz[i] };
+					best[i] = kernels[k](p, np, f, wc, wn, &energy[i]);
+				}
+			double ms = t.ms() / reps;
+
+			int mismatches = 0;
+			if (k == 0)
+			{
+				scalar_ms = ms;
+				scalar_best = best;
+				scalar_energy = energy;
+			}
+			else
+				for (int i = 0; i < nf; i++)
+					if (best[i] != scalar_best[i] || energy[i] != scalar_energy[i]) mismatches++;
+
+			char line[512];
+			snprintf(line, sizeof(line), "    {\"shape\": \"%s\", \"faces\": %d, \"regions\": %d, \"kernel\": \"%s\", "
+				"\"ms\": %.3f, \"speedup\": %.2f, \"mismatches\": %d}",
+				shape.c_str(), nf, np, argmin_energy_name(kernels[k]), ms, scalar_ms / ms, mismatches);
+			out.push_back(line);
+		}
+	}
+
+	template<class T>
+	std::vector<T> parse_list(const char* s)
+	{
+		std::vector<T> v;
+		std::stringstream ss(s);
+		std::string item;
+		while (std::getline(ss, item, ','))
+		{
+			std::stringstream is(item);
+			T x;
+			if (is >> x) v.push_back(x);
+		}
+		return v;
+	}
+
+	bool parse_options(int argc, char** argv, Options& opt)
+	{
+		for (int i = 1; i < argc; i++)
+		{
+			std::string a = argv[i];
+			if (i + 1 >= argc)
+				return false;
+			const char* v = argv[++i];
+			if (a == "--shapes") opt.shapes = parse_list<std::string>(v);
+			else if (a == "--faces") opt.faces = parse_list<int>(v);
+			else if (a == "--regions") opt.regions = parse_list<int>(v);
+			else if (a == "--threads") opt.threads = parse_list<int>(v);
+			else if (a == "--iterations") opt.iterations = atoi(v);
+			else if (a == "--seed") opt.seed = strtoull(v, NULL, 10);
+			else if (a == "--tmp") opt.tmp = v;
+			else return false;
+		}
+		return true;
+	}
+
+}
+
+int main(int argc, char** argv)
+{
+	Options opt;
+	if (!parse_options(argc, argv, opt))
+	{
+		fprintf(stderr, "usage: %s [--shapes a,b] [--faces n,m] [--regions n,m] [--threads n,m] "
+			"[--iterations n] [--seed n] [--tmp file]\n", argv[0]);
+		return 1;
+	}
+
+	printf("{\"benchmark\": \"libcvt\", \"iterations\": %d, \"seed\": %llu,\n \"runs\": [\n", opt.iterations, opt.seed);
+	bool first = true;
+	std::vector<std::string> kernels;
+	for (size_t s = 0; s < opt.shapes.size(); s++)
+		for (size_t f = 0; f < opt.faces.size(); f++)
+		{
+			BenchMesh m;
+			if (!make_shape(opt.shapes[s], opt.faces[f], opt.seed, m))
+			{
+				fprintf(stderr, "unknown shape %s\n", opt.shapes[s].c_str());
+				return 1;
+			}
+			for (size_t r = 0; r < opt.regions.size(); r++)
+				time_kernels(opt.shapes[s], m, opt.regions[r], opt, kernels);
+			for (size_t t = 0; t < opt.threads.size(); t++)
+			{
+				IoTimes io = time_io(m, opt.threads[t], opt.tmp);
+				for (size_t r = 0; r < opt.regions.size(); r++)
+				{
+					run(opt.shapes[s], m, io, opt.regions[r], opt.threads[t], opt, first);
+					first = false;
+				}
+			}
+		}
+	printf("\n ],\n \"kernels\": [\n");
+	for (size_t k = 0; k < kernels.size(); k++)
+		printf("%s%s", kernels[k].c_str(), k + 1 < kernels.size() ? ",\n" : "\n");
+	printf(" ]}\n");
+	return 0;
+}
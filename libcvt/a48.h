@@ -9,9 +9,13 @@
 #include <vector>
 #include <algorithm>
 #include <cmath>
+#include <type_traits>
 
 #include "heap.h"
 #include "geometry.h"
+#include "thread_pool.h"
+#include "arena.h"
+#include "indexed_container.h"
 
 namespace A48 {
 
@@ -25,18 +29,29 @@ class Vertex;
 class Markable;
 class Error;
 
+// Define A48_INDEXED_CONTAINERS to keep the mesh elements in vectors
+// indexed by their index field instead of pointer-ordered sets.
+#ifdef A48_INDEXED_CONTAINERS
+typedef IndexedContainer<Patch>  PatchContainer;
+typedef IndexedContainer<Face>  FaceContainer;
+typedef IndexedContainer<Edge>  EdgeContainer;
+typedef IndexedContainer<Vertex>  VertexContainer;
+#else
 typedef std::set<Patch*>  PatchContainer; 
-typedef PatchContainer::iterator PatchIter;
-
 typedef std::set<Face*>  FaceContainer; 
-typedef FaceContainer::iterator FaceIter;
-
 typedef std::set<Edge*>  EdgeContainer;
-typedef EdgeContainer::iterator EdgeIter;
-
 typedef std::set<Vertex*>  VertexContainer;
+#endif
+
+typedef PatchContainer::iterator PatchIter;
+typedef FaceContainer::iterator FaceIter;
+typedef EdgeContainer::iterator EdgeIter;
 typedef VertexContainer::iterator VertexIter;
 
+// faces of one patch, a sparse subset of the mesh faces
+typedef std::set<Face*>  PatchFaceContainer;
+typedef PatchFaceContainer::iterator PatchFaceIter;
+
 class Ipair;
 typedef std::map<const Ipair, A48::Hedge*> HedgeMap;
 
@@ -72,20 +87,33 @@ struct Point {
   Vector3     g;    // 3D position
   Vector3     n;    // normal
 
-  Vector3     g2;    // 3D position
-  Vector3     n2;    // normal
+  Point() {g[0]=g[1]=g[2]=0; n[0]=n[1]=n[2]=0;}
+  Point(Vector3 pos) : g(pos) { n[0]=n[1]=n[2]=0;}
+  Point(double x, double y, double z) { 
+    g[0]=x; g[1]=y; g[2]=z; n[0]=n[1]=n[2]=0;
+  }
+};
+
+// Optional per-element data. The mesh keeps each group in arrays indexed
+// by the element index, allocated only once asked for with
+// Mesh::request_attributes, so Vertex and Face do not carry it.
+enum MeshAttribute {
+  ATTR_TEXCOORDS = 1,   // texture coordinates per vertex and per face corner
+  ATTR_SECONDARY = 2,   // second position and normal per vertex
+  ATTR_CURVATURE = 4,   // mixed area and curvatures per vertex
+  ATTR_ALL       = 7
+};
 
+struct Curvature {
   double      mixed_area;
   double      gauss_curvature;
   double      mean_curvature;
 
-  Vector3     t;    // texture coordinates
+  Curvature() : mixed_area(0), gauss_curvature(0), mean_curvature(0) {}
+};
 
-  Point() {g[0]=g[1]=g[2]=0; n[0]=n[1]=n[2]=0; g2[0]=g2[1]=g2[2]=0; n2[0]=n2[1]=n2[2]=0; t[0]=t[1]=t[2]=0;}
-  Point(Vector3 pos) : g(pos) { n[0]=n[1]=n[2]=0; t[0]=t[1]=t[2]=0;}
-  Point(double x, double y, double z) { 
-    g[0]=x; g[1]=y; g[2]=z; n[0]=n[1]=n[2]=0; t[0]=t[1]=t[2]=0;;
-  }
+struct FaceTexCoords {
+  Vector3     t[3];   // per corner
 };
 
 
@@ -103,5 +131,6 @@ class Error {
 #include "edge.h"
 #include "vertex.h"
 #include "mesh.h"
+#include "compact_mesh.h"
 
 #endif
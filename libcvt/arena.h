@@ -0,0 +1,121 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace A48 {
+
+	/* Typed slab allocator for the mesh elements. Objects are carved out of
+	   large contiguous slabs and freed slots are recycled through a free
+	   list. release() returns every slab at once without running any
+	   destructor, so the owner destroys the objects that need it first. */
+	template<class T>
+	class ObjectArena {
+	public:
+		explicit ObjectArena(size_t slab_size = 4096)
+			: slab_size_(slab_size), cur_(0), end_(0), free_(0) {}
+		~ObjectArena() { release(); }
+
+		template<class... Args>
+		T* create(Args&&... args) { return new (allocate()) T(std::forward<Args>(args)...); }
+		void destroy(T* p) { p->~T(); deallocate(p); }
+
+		// makes room for n more objects in one contiguous slab
+		void reserve(size_t n);
+		// n contiguous slots for objects the caller constructs in place,
+		// after which they belong to the arena like created ones
+		T* allocate_block(size_t n);
+		bool owns(const T* p) const;
+		void release();
+
+	private:
+		ObjectArena(const ObjectArena&);
+		ObjectArena& operator=(const ObjectArena&);
+
+		struct FreeSlot { FreeSlot* next; };
+
+		void* allocate();
+		void deallocate(T* p);
+		void add_slab(size_t n);
+
+		size_t slab_size_;
+		std::vector<std::pair<T*, size_t> > slabs_;
+		T* cur_;          // next unused slot of the last slab
+		T* end_;
+		FreeSlot* free_;  // recycled slots
+	};
+
+
+	/* implementation */
+
+	template<class T>
+	void* ObjectArena<T>::allocate()
+	{
+		if (free_)
+		{
+			FreeSlot* s = free_;
+			free_ = s->next;
+			return s;
+		}
+		if (cur_ == end_) add_slab(slab_size_);
+		return cur_++;
+	}
+
+	template<class T>
+	void ObjectArena<T>::deallocate(T* p)
+	{
+		FreeSlot* s = reinterpret_cast<FreeSlot*>(p);
+		s->next = free_;
+		free_ = s;
+	}
+
+	template<class T>
+	void ObjectArena<T>::add_slab(size_t n)
+	{
+		static_assert(sizeof(T) >= sizeof(FreeSlot), "arena slots hold a free list pointer");
+		T* slab = static_cast<T*>(::operator new(n * sizeof(T)));
+		slabs_.push_back(std::make_pair(slab, n));
+		cur_ = slab;
+		end_ = slab + n;
+	}
+
+	template<class T>
+	void ObjectArena<T>::reserve(size_t n)
+	{
+		if ((size_t)(end_ - cur_) < n) add_slab(n > slab_size_ ? n : slab_size_);
+	}
+
+	template<class T>
+	T* ObjectArena<T>::allocate_block(size_t n)
+	{
+		reserve(n);
+		T* p = cur_;
+		cur_ += n;
+		return p;
+	}
+
+	template<class T>
+	bool ObjectArena<T>::owns(const T* p) const
+	{
+		for (size_t i = 0; i < slabs_.size(); i++)
+			if (p >= slabs_[i].first && p < slabs_[i].first + slabs_[i].second)
+				return true;
+		return false;
+	}
+
+	template<class T>
+	void ObjectArena<T>::release()
+	{
+		for (size_t i = 0; i < slabs_.size(); i++)
+			::operator delete(slabs_[i].first);
+		slabs_.clear();
+		cur_ = end_ = 0;
+		free_ = 0;
+	}
+
+}
+
+#endif
@@ -0,0 +1,298 @@
+#ifndef BINARY_MESH_H
+#define BINARY_MESH_H
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+
+#include "mapped_file.h"
+#include "off_io.h"
+
+namespace libcvd {
+
+	/* Binary triangle mesh laid out to be used straight from a memory map:
+	   a fixed header, then each array at a 64-byte aligned offset, in the
+	   byte order of the machine that wrote it. Positions are 3 doubles per
+	   vertex, triangles 3 ints per face, colors 3 floats in [0, 1] per
+	   vertex and labels one region per face; the last two are optional
+	   and have offset 0 when absent. A cache also records the size and
+	   modification time of the file it was made from. */
+	struct BinaryMeshHeader {
+		enum { VERSION = 2, BYTE_ORDER_MARK = 0x01020304 };
+
+		char magic[8];                  // "LIBCVTM"
+		unsigned int version;
+		unsigned int byte_order;        // BYTE_ORDER_MARK as written
+		unsigned long long num_verts;
+		unsigned long long num_faces;
+		unsigned long long positions_offset;
+		unsigned long long tris_offset;
+		unsigned long long colors_offset;
+		unsigned long long labels_offset;
+		unsigned long long file_size;
+		unsigned long long source_size;     // 0 when not a cache
+		long long source_mtime_ns;
+	};
+
+	// Size and modification time of a file, in nanoseconds where the
+	// system keeps them.
+	bool binary_mesh_file_stamp(const std::string& filename, unsigned long long& size, long long& mtime_ns);
+
+	/* Read-only view of a binary mesh, either a mapped file or an image
+	   kept in memory when the file could not be written. */
+	class BinaryMesh {
+	public:
+		BinaryMesh() : data_(0), header_(0) {}
+
+		bool open(const std::string& filename);
+		// takes over an image made by make_binary_mesh
+		bool adopt(std::vector<char>& image);
+		void close();
+
+		int num_verts() const { return header_ ? (int)header_->num_verts : 0; }
+		int num_faces() const { return header_ ? (int)header_->num_faces : 0; }
+		const double* positions() const { return (const double*)array(header_->positions_offset); }
+		const int* tris() const { return (const int*)array(header_->tris_offset); }
+		const float* colors() const { return (const float*)array(header_->colors_offset); }   // NULL if none
+		const int* labels() const { return (const int*)array(header_->labels_offset); }       // NULL if none
+		unsigned long long source_size() const { return header_ ? header_->source_size : 0; }
+		long long source_mtime_ns() const { return header_ ? header_->source_mtime_ns : 0; }
+
+	private:
+		BinaryMesh(const BinaryMesh&);
+		BinaryMesh& operator=(const BinaryMesh&);
+
+		bool validate(size_t size);
+		const char* array(unsigned long long offset) const { return offset ? data_ + offset : 0; }
+
+		A48::MappedFile file_;
+		std::vector<char> image_;
+		const char* data_;
+		const BinaryMeshHeader* header_;
+	};
+
+	// Lays out a binary mesh in memory; colors and labels may be NULL.
+	void make_binary_mesh(std::vector<char>& image, const double* positions, int nverts,
+		const int* tris, int nfaces, const float* colors = NULL, const int* labels = NULL);
+	bool write_binary_mesh(const std::string& filename, const double* positions, int nverts,
+		const int* tris, int nfaces, const float* colors = NULL, const int* labels = NULL);
+	bool write_binary_image(const std::string& filename, const std::vector<char>& image);
+
+	// Cache file kept next to an OFF file.
+	std::string binary_cache_name(const std::string& off_filename);
+	// Opens the cache of an OFF file when it records the current size and
+	// modification time of the file, or otherwise parses the OFF file and
+	// writes the cache. Polygons are split in fans of triangles.
+	bool load_off_cached(const std::string& off_filename, BinaryMesh& mesh, int threads = 1);
+
+
+	/* implementation */
+
+	inline unsigned long long binary_mesh_align(unsigned long long n)
+	{
+		return (n + 63) & ~63ull;
+	}
+
+	inline void make_binary_mesh(std::vector<char>& image, const double* positions, int nverts,
+		const int* tris, int nfaces, const float* colors, const int* labels)
+	{
+		BinaryMeshHeader h;
+		memset(&h, 0, sizeof(h));
+		memcpy(h.magic, "LIBCVTM", 8);
+		h.version = BinaryMeshHeader::VERSION;
+		h.byte_order = BinaryMeshHeader::BYTE_ORDER_MARK;
+		h.num_verts = nverts;
+		h.num_faces = nfaces;
+
+		unsigned long long at = binary_mesh_align(sizeof(h));
+		h.positions_offset = at; at = binary_mesh_align(at + 3ull * nverts * sizeof(double));
+		h.tris_offset = at;      at = binary_mesh_align(at + 3ull * nfaces * sizeof(int));
+		if (colors) { h.colors_offset = at; at = binary_mesh_align(at + 3ull * nverts * sizeof(float)); }
+		if (labels) { h.labels_offset = at; at = binary_mesh_align(at + (unsigned long long)nfaces * sizeof(int)); }
+		h.file_size = at;
+
+		image.assign((size_t)at, 0);
+		memcpy(&image[0], &h, sizeof(h));
+		if (nverts) memcpy(&image[h.positions_offset], positions, 3ull * nverts * sizeof(double));
+		if (nfaces) memcpy(&image[h.tris_offset], tris, 3ull * nfaces * sizeof(int));
+		if (colors && nverts) memcpy(&image[h.colors_offset], colors, 3ull * nverts * sizeof(float));
+		if (labels && nfaces) memcpy(&image[h.labels_offset], labels, (size_t)nfaces * sizeof(int));
+	}
+
+	inline bool write_binary_mesh(const std::string& filename, const double* positions, int nverts,
+		const int* tris, int nfaces, const float* colors, const int* labels)
+	{
+		std::vector<char> image;
+		make_binary_mesh(image, positions, nverts, tris, nfaces, colors, labels);
+		return write_binary_image(filename, image);
+	}
+
+	/* Written to a temporary name first and renamed over the old file, so
+	   a reader never maps a half-written file nor, on POSIX, finds none.
+	   The temporary name holds the process id and a counter, so that
+	   writers of the same file, in any process or thread, never share it. */
+	inline bool write_binary_image(const std::string& filename, const std::vector<char>& image)
+	{
+		static std::atomic<unsigned> counter(0);
+#ifdef _WIN32
+		unsigned long pid = GetCurrentProcessId();
+#else
+		unsigned long pid = (unsigned long)getpid();
+#endif
+		std::string tmp = filename + "." + std::to_string(pid) + "." + std::to_string(counter++) + ".tmp";
+		FILE* f = fopen(tmp.c_str(), "wb");
+		if (!f) return false;
+		bool ok = fwrite(&image[0], 1, image.size(), f) == image.size();
+		ok = (fclose(f) == 0) && ok;
+#ifdef _WIN32
+		// rename does not replace an existing file there
+		remove(filename.c_str());
+#endif
+		if (!ok || rename(tmp.c_str(), filename.c_str()) != 0)
+		{
+			remove(tmp.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	// n elements of the given size at offset lie inside size bytes, past
+	// the header and naturally aligned; offsets are checked by subtraction
+	// so that none can wrap
+	inline bool binary_mesh_array_ok(unsigned long long offset, unsigned long long n, size_t elem, size_t size)
+	{
+		return offset >= sizeof(BinaryMeshHeader) && offset <= size && offset % elem == 0
+			&& n <= (size - offset) / elem;
+	}
+
+	/* Checks the header, every array against the size and the triangles
+	   against the vertices, once, so that the accessors can be trusted. */
+	inline bool BinaryMesh::validate(size_t size)
+	{
+		header_ = (const BinaryMeshHeader*)data_;
+		const BinaryMeshHeader& h = *header_;
+		bool ok = size >= sizeof(h)
+			&& (size_t)data_ % sizeof(double) == 0
+			&& memcmp(h.magic, "LIBCVTM", 8) == 0
+			&& h.version == BinaryMeshHeader::VERSION
+			&& h.byte_order == BinaryMeshHeader::BYTE_ORDER_MARK
+			&& h.file_size == size
+			&& h.num_verts < (1ull << 31) && h.num_faces < (1ull << 31)
+			&& binary_mesh_array_ok(h.positions_offset, 3 * h.num_verts, sizeof(double), size)
+			&& binary_mesh_array_ok(h.tris_offset, 3 * h.num_faces, sizeof(int), size)
+			&& (!h.colors_offset || binary_mesh_array_ok(h.colors_offset, 3 * h.num_verts, sizeof(float), size))
+			&& (!h.labels_offset || binary_mesh_array_ok(h.labels_offset, h.num_faces, sizeof(int), size));
+		if (ok)
+		{
+			const int* t = tris();
+			for (unsigned long long i = 0; i < 3 * h.num_faces && ok; i++)
+				ok = t[i] >= 0 && (unsigned long long)t[i] < h.num_verts;
+		}
+		if (!ok) close();
+		return ok;
+	}
+
+	inline bool BinaryMesh::open(const std::string& filename)
+	{
+		close();
+		if (!file_.open(filename) || file_.size() < sizeof(BinaryMeshHeader))
+		{
+			file_.close();
+			return false;
+		}
+		data_ = file_.data();
+		return validate(file_.size());
+	}
+
+	inline bool BinaryMesh::adopt(std::vector<char>& image)
+	{
+		close();
+		image_.swap(image);
+		if (image_.size() < sizeof(BinaryMeshHeader)) { close(); return false; }
+		data_ = &image_[0];
+		return validate(image_.size());
+	}
+
+	inline void BinaryMesh::close()
+	{
+		file_.close();
+		std::vector<char>().swap(image_);
+		data_ = 0;
+		header_ = 0;
+	}
+
+	inline bool binary_mesh_file_stamp(const std::string& filename, unsigned long long& size, long long& mtime_ns)
+	{
+		struct stat st;
+		if (stat(filename.c_str(), &st) != 0)
+			return false;
+		size = (unsigned long long)st.st_size;
+#if defined(__APPLE__)
+		mtime_ns = (long long)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#elif defined(_WIN32)
+		mtime_ns = (long long)st.st_mtime * 1000000000;
+#else
+		mtime_ns = (long long)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+		return true;
+	}
+
+	inline std::string binary_cache_name(const std::string& off_filename)
+	{
+		return off_filename + ".cvtb";
+	}
+
+	inline bool load_off_cached(const std::string& off_filename, BinaryMesh& mesh, int threads)
+	{
+		std::string cache = binary_cache_name(off_filename);
+
+		// equal stamps rather than a newer cache, which a file edited in
+		// the second the cache was written would pass
+		unsigned long long src_size = 0;
+		long long src_mtime = 0;
+		bool have_src = binary_mesh_file_stamp(off_filename, src_size, src_mtime);
+		if (mesh.open(cache) && (!have_src
+			|| (mesh.source_size() == src_size && mesh.source_mtime_ns() == src_mtime)))
+			return true;
+		mesh.close();
+		if (!have_src)
+			return false;
+
+		OffData off;
+		if (!load_off(off_filename, off, threads))
+			return false;
+
+		std::vector<int> tris;
+		tris.reserve(3 * off.num_faces());
+		for (int f = 0; f < off.num_faces(); f++)
+		{
+			const int* v = &off.face_indices[0] + off.face_offsets[f];
+			for (int k = 2; k < off.face_offsets[f+1] - off.face_offsets[f]; k++)
+			{
+				tris.push_back(v[0]);
+				tris.push_back(v[k-1]);
+				tris.push_back(v[k]);
+			}
+		}
+
+		std::vector<float> colors(off.colors.begin(), off.colors.end());
+		std::vector<char> image;
+		make_binary_mesh(image, off.positions.data(), off.num_verts(), tris.data(), (int)tris.size() / 3,
+			off.has_colors() ? colors.data() : NULL);
+		// stamped as the file was before parsing, so a later edit is seen
+		BinaryMeshHeader* h = (BinaryMeshHeader*)&image[0];
+		h->source_size = src_size;
+		h->source_mtime_ns = src_mtime;
+
+		// a read-only directory only costs the cache
+		if (write_binary_image(cache, image) && mesh.open(cache))
+			return true;
+		return mesh.adopt(image);
+	}
+
+}
+
+#endif
@@ -0,0 +1,156 @@
+#ifndef COMPACT_MESH_H
+#define COMPACT_MESH_H
+
+#include <vector>
+
+#include "a48.h"
+
+namespace A48 {
+
+	/* Triangle mesh connectivity held in flat int arrays. Half edge h is
+	   slot h % 3 of face h / 3 and, as in Mesh::build, slot k of a face
+	   goes from corner NEXT3(k) to corner PREV3(k), so face(h), next(h) and
+	   the corner opposite h are implicit. Only the opposite half edge is
+	   stored, since implicit mates (h ^ 1) and implicit faces (h / 3)
+	   cannot both hold. Per face this is 24 bytes of connectivity instead
+	   of a Face, one and a half Edges and their container nodes. */
+	class CompactMesh {
+	public:
+		std::vector<Vector3> positions;  // per vertex
+		std::vector<int> tris;           // 3 corners per face
+		std::vector<int> opp;            // per half edge, -1 on the boundary
+		std::vector<int> star;           // half edge into each vertex, -1 if isolated
+
+		// Builds the connectivity from a flat triangle index buffer;
+		// xyz holds 3 coordinates per vertex, as floats or doubles. False,
+		// with the mesh left empty, when an index is out of range.
+		template<class Real>
+		bool build(const Real* xyz, int nverts, const int* tris, int nfaces, ThreadPool* pool = NULL);
+
+		int num_verts() const { return (int)positions.size(); }
+		int num_faces() const { return (int)tris.size() / 3; }
+		int num_hedges() const { return (int)tris.size(); }
+
+		static int face(int h) { return h / 3; }
+		static int next(int h) { return 3 * (h / 3) + NEXT3(h % 3); }
+		static int prev(int h) { return 3 * (h / 3) + PREV3(h % 3); }
+		int mate(int h) const { return opp[h]; }
+		int org(int h) const { return tris[3 * (h / 3) + NEXT3(h % 3)]; }
+		int dst(int h) const { return tris[3 * (h / 3) + PREV3(h % 3)]; }
+		int vertex(int f, int k) const { return tris[3 * f + k]; }
+		bool is_bdry(int h) const { return opp[h] < 0; }
+
+		// half edges into v, walked like Vertex::star_first/star_next;
+		// star_next returns -1 past the last one
+		int star_first(int v) const { return star[v]; }
+		int star_next(int v, int h) const
+		{
+			int n = opp[next(h)];
+			return (n == star[v]) ? -1 : n;
+		}
+
+		// same formulas as Face::calculate_center/area/normal
+		Vector3 face_center(int f);
+		double face_area(int f);
+		Vector3 face_normal(int f);
+
+		size_t memory_bytes() const;
+	};
+
+
+	/* implementation */
+
+	/* Slots are paired with the half edge running the other way along the
+	   same undirected edge, found by sorting the edge keys. Edges shared
+	   by more than two faces, or by two faces of opposite orientation, are
+	   left as boundary on every side. */
+	template<class Real>
+	inline bool CompactMesh::build(const Real* xyz, int nverts, const int* t, int nfaces, ThreadPool* pool)
+	{
+		ThreadPool serial(1);
+		if (!pool) pool = &serial;
+		const int CHUNK = 4096;
+
+		positions.clear(); tris.clear(); opp.clear(); star.clear();
+		for (int i = 0; i < 3 * nfaces; i++)
+			if (t[i] < 0 || t[i] >= nverts)
+				return false;
+
+		positions.resize(nverts);
+		for (int v = 0; v < nverts; v++)
+			positions[v] = Vector3(xyz[3*v], xyz[3*v + 1], xyz[3*v + 2]);
+		tris.assign(t, t + 3 * nfaces);
+
+		int nslots = 3 * nfaces;
+		std::vector<unsigned long long> keys(nslots);
+		std::vector<int> slots(nslots);
+
+		pool->parallel_for(nslots, CHUNK, [&](int begin, int end, int) {
+			for (int h = begin; h < end; h++) {
+				unsigned a = org(h), b = dst(h);
+				if (a > b) std::swap(a, b);
+				keys[h] = ((unsigned long long)a << 32) | b;
+				slots[h] = h;
+			}
+		});
+
+		sort_edge_keys(keys, slots);
+
+		// each run of equal keys is paired by the thread holding its start
+		opp.assign(nslots, -1);
+		pool->parallel_for(nslots, CHUNK, [&](int begin, int end, int) {
+			for (int i = begin; i < end; i++) {
+				if (i > 0 && keys[i] == keys[i-1])
+					continue;
+				if (i + 1 < nslots && keys[i + 1] == keys[i] && (i + 2 == nslots || keys[i + 2] != keys[i])
+					&& org(slots[i]) == dst(slots[i + 1])) {
+					opp[slots[i]] = slots[i + 1];
+					opp[slots[i + 1]] = slots[i];
+				}
+			}
+		});
+
+		// the first half edge into each vertex, or the last boundary one,
+		// which starts its fan as in link_mesh; in slot order, so that
+		// non-manifold vertices get the same star whatever the threads
+		star.assign(nverts, -1);
+		for (int h = 0; h < nslots; h++) {
+			int v = dst(h);
+			if (opp[h] < 0) star[v] = h;
+			else if (star[v] < 0) star[v] = h;
+		}
+		return true;
+	}
+
+	inline Vector3 CompactMesh::face_center(int f)
+	{
+		Vector3 c = positions[tris[3*f]] + positions[tris[3*f + 1]] + positions[tris[3*f + 2]];
+		c *= 1/3.;
+		return c;
+	}
+
+	inline double CompactMesh::face_area(int f)
+	{
+		Vector3 a01 = positions[tris[3*f]] - positions[tris[3*f + 1]];
+		Vector3 a02 = positions[tris[3*f]] - positions[tris[3*f + 2]];
+		return 1/2. * (a01 ^ a02).norm();
+	}
+
+	inline Vector3 CompactMesh::face_normal(int f)
+	{
+		Vector3 a01 = positions[tris[3*f]] - positions[tris[3*f + 1]];
+		Vector3 a02 = positions[tris[3*f]] - positions[tris[3*f + 2]];
+		Vector3 n = a01 ^ a02;
+		n.normalize();
+		return n;
+	}
+
+	inline size_t CompactMesh::memory_bytes() const
+	{
+		return positions.capacity() * sizeof(Vector3)
+			+ (tris.capacity() + opp.capacity() + star.capacity()) * sizeof(int);
+	}
+
+}
+
+#endif
@@ -1,15 +1,16 @@
 #pragma once
 
 #include "lloyd_euclidean_cvd.h"
+#include "off_io.h"
+#include "binary_mesh.h"
+#include "ply_io.h"
 
 namespace libcvd{
-	inline unsigned RGB(double x) {
-		return  (x < 0) ? 0 : (x > 255) ? 255 : unsigned(x);
-	}
     struct SimpleMesh{
         std::vector<std::vector<double> > verts;
 		std::vector<std::vector<int> > faces;
 		std::vector<std::vector<double> > vertColor;
+		std::vector<int> faceRegions;   // region of each face, empty if none
         void addVertex(double x, double y, double z){
             std::vector<double> c(3);
             c[0] = x; c[1] = y; c[2] = z;
@@ -28,207 +29,449 @@ namespace libcvd{
 			vertColor.push_back(c);
 		}
 
-		bool loadOFF(std::string filename) {
-			using namespace std;
-			FILE* off_file;
-			errno_t err = fopen_s(&off_file, filename.c_str(), "r");
-			if (err != 0) return false;
-			// First line is always OFF
-			char header[1000];
-			const std::string OFF("OFF");
-			const std::string NOFF("NOFF");
-			const std::string COFF("COFF");
-			std::cout << "hello" << std::endl;
-			if (std::fscanf(off_file, "%s\n", header) != 1
-				|| !(
-					string(header).compare(0, OFF.length(), OFF) == 0 ||
-					string(header).compare(0, COFF.length(), COFF) == 0 ||
-					string(header).compare(0, NOFF.length(), NOFF) == 0))
-			{
-				printf("Error: readOFF() first line should be OFF or NOFF or COFF, not %s...", header);
-				fclose(off_file);
+		// threads as for ThreadPool, 0 for all cores
+		bool loadOFF(std::string filename, int threads = 1) {
+			OffData off;
+			if (!load_off(filename, off, threads))
 				return false;
-			}
-			bool has_normals = string(header).compare(0, NOFF.length(), NOFF) == 0;
-			bool has_vertexColors = string(header).compare(0, COFF.length(), COFF) == 0;
-			// Second line is #vertices #faces #edges
-			int number_of_vertices;
-			int number_of_faces;
-			int number_of_edges;
-			char tic_tac_toe;
-			char line[1000];
-			bool still_comments = true;
-			while (still_comments)
-			{
-				fgets(line, 1000, off_file);
-				still_comments = line[0] == '#';
-			}
-			sscanf(line, "%d %d %d", &number_of_vertices, &number_of_faces, &number_of_edges);
+
+			int number_of_vertices = off.num_verts();
+			int number_of_faces = off.num_faces();
+
 			verts.resize(number_of_vertices);
-			faces.resize(number_of_faces);
-			if (has_normals)
-				;// N.resize(number_of_vertices);
-			if (has_vertexColors)
-				vertColor.resize(number_of_vertices);
-			
-			printf("%s %d %d %d\n",(has_normals ? "NOFF" : "OFF"),number_of_vertices,number_of_faces,number_of_edges);
-			// Read vertices
-			for (int i = 0; i < number_of_vertices;)
+			for (int i = 0; i < number_of_vertices; i++)
+				verts[i].assign(&off.positions[3*i], &off.positions[3*i] + 3);
+
+			vertColor.clear();
+			if (off.has_colors())
 			{
-				fgets(line, 1000, off_file);
-				double x, y, z, nx, ny, nz;
-				if (sscanf(line, "%lg %lg %lg %lg %lg %lg", &x, &y, &z, &nx, &ny, &nz) >= 3)
-				{
-					std::vector<double> vertex(3);
-					vertex[0] = x;
-					vertex[1] = y;
-					vertex[2] = z;
-					verts[i] = vertex;
-
-					if (has_normals)
-					{
-						std::vector<double> normal(3);
-						normal[0] = nx;
-						normal[1] = ny;
-						normal[2] = nz;
-						//N[i] = normal;
-					}
-
-					if (has_vertexColors)
-					{
-						std::vector<double> color(3);
-						color[0] = nx / 255.0;
-						color[1] = ny / 255.0;
-						color[2] = nz / 255.0;
-						vertColor[i] = color;
-					}
-					i++;
-				}
-				else if (
-					fscanf(off_file, "%[#]", &tic_tac_toe) == 1)
-				{
-					char comment[1000];
-					fscanf(off_file, "%[^\n]", comment);
-				}
-				else
-				{
-					printf("Error: bad line (%d)\n", i);
-					if (feof(off_file))
-					{
-						fclose(off_file);
-						return false;
-					}
-				}
+				vertColor.resize(number_of_vertices);
+				for (int i = 0; i < number_of_vertices; i++)
+					vertColor[i].assign(&off.colors[3*i], &off.colors[3*i] + 3);
 			}
-			
-			// Read faces
-			for (int i = 0; i < number_of_faces;)
+
+			faces.resize(number_of_faces);
+			for (int i = 0; i < number_of_faces; i++)
+				faces[i].assign(off.face_indices.begin() + off.face_offsets[i], off.face_indices.begin() + off.face_offsets[i+1]);
+			faceRegions.clear();
+			return true;
+		}
+		
+		// same through the binary cache kept next to the OFF file
+		bool loadOFFCached(std::string filename, int threads = 1) {
+			BinaryMesh bin;
+			if (!load_off_cached(filename, bin, threads))
+				return false;
+
+			const double* p = bin.positions();
+			verts.resize(bin.num_verts());
+			for (int i = 0; i < bin.num_verts(); i++)
+				verts[i].assign(p + 3*i, p + 3*i + 3);
+
+			vertColor.clear();
+			if (const float* c = bin.colors())
 			{
-				std::vector<int> face;
-				int valence;
-				if (fscanf(off_file, "%d", &valence) == 1)
-				{
-					face.resize(valence);
-					for (int j = 0; j < valence; j++)
-					{
-						int index;
-						if (j < valence - 1)
-						{
-							fscanf(off_file, "%d", &index);
-						}
-						else {
-							fscanf(off_file, "%d%*[^\n]", &index);
-						}
-
-						face[j] = index;
-					}
-					faces[i] = face;
-					i++;
-				}
-				else if (
-					fscanf(off_file, "%[#]", &tic_tac_toe) == 1)
-				{
-					char comment[1000];
-					fscanf(off_file, "%[^\n]", comment);
-				}
-				else
-				{
-					printf("Error: bad line\n");
-					fclose(off_file);
-					return false;
-				}
+				vertColor.resize(bin.num_verts());
+				for (int i = 0; i < bin.num_verts(); i++)
+					vertColor[i].assign(c + 3*i, c + 3*i + 3);
 			}
-			fclose(off_file);
+
+			const int* t = bin.tris();
+			faces.resize(bin.num_faces());
+			for (int i = 0; i < bin.num_faces(); i++)
+				faces[i].assign(t + 3*i, t + 3*i + 3);
+
+			faceRegions.clear();
+			if (const int* l = bin.labels())
+				faceRegions.assign(l, l + bin.num_faces());
 			return true;
 		}
 		
-		bool writeOFF(string filename) {
-			std::ofstream s(filename);
-			bool hasColor = !vertColor.empty();
-			if (!hasColor) {
-				s << "OFF\n" << verts.size() << " " << faces.size() << " 0\n";
-			}
-			else {
-				s << "COFF\n" << verts.size() << " " << faces.size() << " 0\n";
-			}
-			
-			for (unsigned i = 0; i < verts.size(); ++i) {
-				if (hasColor) {
-					s << verts[i][0] << " " << verts[i][1] << " " << verts[i][2] << " ";
-					s << RGB(vertColor[i][0] * 255.0) << " " << RGB(vertColor[i][1] * 255.0) << " " << RGB(vertColor[i][2] * 255.0) << std::endl;
-				}
-				else {
-					s << verts[i][0] << " " << verts[i][1] << " " << verts[i][2] << " ";
-				}
-			}
+		// precision and threads as for write_off
+		bool writeOFF(string filename, int precision = 6, int threads = 1) {
+			return write_off_from(filename, (int)verts.size(), (int)faces.size(), !vertColor.empty(),
+				[&](int i) { return &verts[i][0]; },
+				[&](int i) { return &vertColor[i][0]; },
+				[&](int i, int& n) { n = 3; return &faces[i][0]; },
+				precision, threads);
+		}
+
+		// binary PLY; faceRegions comes from a face "region" property
+		bool loadPLY(std::string filename, int threads = 1) {
+			OffData ply;
+			std::vector<int> regions;
+			if (!load_ply(filename, ply, &regions, threads))
+				return false;
+
+			verts.resize(ply.num_verts());
+			for (int i = 0; i < ply.num_verts(); i++)
+				verts[i].assign(&ply.positions[3*i], &ply.positions[3*i] + 3);
 
-			for (unsigned i = 0; i < faces.size(); ++i) {
-				s << "3 " << faces[i][0] << " " << faces[i][1] << " " << faces[i][2] << std::endl;
+			vertColor.clear();
+			if (ply.has_colors())
+			{
+				vertColor.resize(ply.num_verts());
+				for (int i = 0; i < ply.num_verts(); i++)
+					vertColor[i].assign(&ply.colors[3*i], &ply.colors[3*i] + 3);
 			}
-			s.close();
+
+			faces.resize(ply.num_faces());
+			for (int i = 0; i < ply.num_faces(); i++)
+				faces[i].assign(ply.face_indices.begin() + ply.face_offsets[i], ply.face_indices.begin() + ply.face_offsets[i+1]);
+
+			faceRegions.clear();
+			for (int i = 0; i < (int)regions.size(); i++)
+				if (regions[i] >= 0) { faceRegions.swap(regions); break; }
 			return true;
 		}
+
+		// binary little-endian PLY with vertex colors and face regions when set
+		bool writePLY(string filename) {
+			return write_ply_from(filename, (int)verts.size(), (int)faces.size(), !vertColor.empty(),
+				faceRegions.size() == faces.size() && !faces.empty(),
+				[&](int i) { return &verts[i][0]; },
+				[&](int i) { return &vertColor[i][0]; },
+				[&](int i, int& n) { n = (int)faces[i].size(); return &faces[i][0]; },
+				[&](int i) { return faceRegions[i]; });
+		}
     };
 
-    void computeCVT(SimpleMesh & m, int regions = 20, int iterations = 200)
+    /* Result of a CVT. face_region holds the region of every face; per
+       region there is the center and unit normal the iterations settled
+       on (3 values each), the total area of its faces and the index of
+       its center face, the face the center was projected on. */
+    struct CvtResult {
+        std::vector<int> face_region;
+        std::vector<double> centers;
+        std::vector<double> normals;
+        std::vector<double> areas;
+        std::vector<int> center_face;
+
+        int num_regions() const { return (int)areas.size(); }
+        void resize(int nfaces, int regions) {
+            face_region.resize(nfaces);
+            centers.resize(3 * (size_t)regions);
+            normals.resize(3 * (size_t)regions);
+            areas.resize(regions);
+            center_face.resize(regions);
+        }
+        void clear() { resize(0, 0); }
+    };
+
+    /* Checks the buffers and builds the mesh for the entry points below;
+       returns the number of regions to use, 0 if there is nothing to do. */
+    template<class Real>
+    int cvt_build_mesh(CompactMesh& mesh, const Real* positions, int nverts, const int* tris, int nfaces,
+        int regions, int threads)
     {
-        Mesh mesh;
+        if (nverts <= 0 || nfaces <= 0 || regions <= 0)
+            return 0;
 
-        // insert vertices:
-        Vertex** verts = new Vertex*[m.verts.size()];
-        for(int i = 0; i < (int)m.verts.size(); i++)
+        ThreadPool pool(threads);
+        if (!mesh.build(positions, nverts, tris, nfaces, &pool))
+            return 0;
+        return std::min(regions, nfaces);
+    }
+
+    /* Copies the outcome of a CVT run on mesh into flat arrays sized as in
+       CvtResult, in one pass over the faces; any of them may be NULL. */
+    template<class Real>
+    void cvt_outputs(const ILloydCvd& cvd, CompactMesh& mesh, int* face_region,
+        Real* centers, Real* normals, Real* areas, int* center_face)
+    {
+        const vector<int>& labels = cvd.face_labels();
+        const PatchBuffers& r = cvd.region_data();
+        int nf = (int)labels.size();
+
+        if (areas)
+            std::fill(areas, areas + r.size(), Real(0));
+        if (face_region || areas)
+            for (int f = 0; f < nf; f++)
+            {
+                if (face_region) face_region[f] = labels[f];
+                if (areas && labels[f] >= 0) areas[labels[f]] += (Real)mesh.face_area(f);
+            }
+
+        for (int i = 0; i < r.size(); i++)
         {
-            verts[i] = new Vertex();
-            verts[i]->a = Point(m.verts[i][0], m.verts[i][1], m.verts[i][2]);
-			verts[i]->index = i;
-            mesh.put_vertex(verts[i]);
+            if (centers) { centers[3*i] = (Real)r.cx[i]; centers[3*i + 1] = (Real)r.cy[i]; centers[3*i + 2] = (Real)r.cz[i]; }
+            if (normals) { normals[3*i] = (Real)r.nx[i]; normals[3*i + 1] = (Real)r.ny[i]; normals[3*i + 2] = (Real)r.nz[i]; }
+            if (center_face) center_face[i] = r.center_face[i];
         }
+    }
 
-        auto hedges = new HedgeMap();
+    /* Entry point over the caller's own buffers: positions holds 3
+       coordinates per vertex, as floats or doubles, and tris 3 vertex
+       indices per face. Both are copied once, straight into the
+       CompactMesh the CVT runs on, with no SimpleMesh or per-element
+       objects in between. The region of face i is written to
+       face_labels[i] (nfaces ints) and, when region_centers is not NULL,
+       the center of region r to region_centers[3*r .. 3*r + 2]. regions
+       is clamped to the number of faces; returns the number of regions,
+       0 when the mesh is empty or an index is out of range. The seeds are
+       drawn from rng, so the result only depends on it and the input, not
+       on threads. */
+    template<class Real>
+    int computeCVT(const Real* positions, int nverts, const int* tris, int nfaces,
+        int* face_labels, Real* region_centers = NULL, int regions = 20, int iterations = 200, int threads = 1,
+        const Rng& rng = Rng())
+    {
+        CompactMesh mesh;
+        regions = cvt_build_mesh(mesh, positions, nverts, tris, nfaces, regions, threads);
+        if (!regions)
+            return 0;
 
-        // insert faces:
-        for(int i = 0; i < (int)m.faces.size(); i++)
-            mesh.put_face(m.faces[i][0], m.faces[i][1], m.faces[i][2], verts, hedges);
+        LloydCvd cvd(&mesh);
+        cvd.set_num_threads(threads);
+        cvd.rng = rng;
+        cvd.lloyd_euclidean_cvd(&mesh, regions, iterations);
 
-		// build adjacency
-		mesh.link_mesh();
+        cvt_outputs(cvd, mesh, face_labels, region_centers, (Real*)NULL, (Real*)NULL, (int*)NULL);
+        return regions;
+    }
+
+    // same, with every output in result
+    template<class Real>
+    int computeCVT(const Real* positions, int nverts, const int* tris, int nfaces,
+        CvtResult& result, int regions = 20, int iterations = 200, int threads = 1, const Rng& rng = Rng())
+    {
+        result.clear();
+        CompactMesh mesh;
+        regions = cvt_build_mesh(mesh, positions, nverts, tris, nfaces, regions, threads);
+        if (!regions)
+            return 0;
 
-		// Compute CVT
         LloydCvd cvd(&mesh);
-		cvd.lloyd_euclidean_cvd(&mesh, regions, iterations);
+        cvd.set_num_threads(threads);
+        cvd.rng = rng;
+        cvd.lloyd_euclidean_cvd(&mesh, regions, iterations);
 
-		// DEBUG with vertex colors:
-		std::map < int, std::vector<double> > vcolors;
-		for (auto p : mesh.pc_){
-			std::vector<double> c(3);
-			c[0] = random1();c[1] = random1();c[2] = random1();
-			for (auto f : p->fpc_)
-				for (int i = 0; i < 3; i++)
-					vcolors[f->vertex(i)->index] = c;
-		}
-		for (auto keyValue : vcolors){
-			auto c = keyValue.second;
-			m.addVertexColor(c[0], c[1], c[2]);
-		}
+        result.resize(nfaces, regions);
+        cvt_outputs(cvd, mesh, result.face_region.data(), result.centers.data(), result.normals.data(),
+            result.areas.data(), result.center_face.data());
+        return regions;
+    }
+
+    /* Flat copies of the vertex positions and of the faces of m, polygons
+       split in fans of triangles; tri_face gets the face of each triangle.
+       False when a vertex has fewer than 3 coordinates or a face fewer
+       than 3 corners. */
+    inline bool flattenMesh(const SimpleMesh & m, std::vector<double>& positions, std::vector<int>& tris,
+        std::vector<int>& tri_face)
+    {
+        positions.resize(3 * m.verts.size());
+        for(int i = 0; i < (int)m.verts.size(); i++)
+        {
+            if (m.verts[i].size() < 3)
+                return false;
+            for(int k = 0; k < 3; k++)
+                positions[3*i + k] = m.verts[i][k];
+        }
+
+        tris.clear();
+        tri_face.clear();
+        tris.reserve(3 * m.faces.size());
+        tri_face.reserve(m.faces.size());
+        for(int i = 0; i < (int)m.faces.size(); i++)
+        {
+            const std::vector<int>& f = m.faces[i];
+            if (f.size() < 3)
+                return false;
+            for(int k = 2; k < (int)f.size(); k++)
+            {
+                tris.push_back(f[0]);
+                tris.push_back(f[k-1]);
+                tris.push_back(f[k]);
+                tri_face.push_back(i);
+            }
+        }
+        return true;
+    }
+
+    /* Turns a result over the triangles of flattenMesh into one over the
+       faces it came from: a polygon takes the region of its first
+       triangle, and center faces become the polygons holding them. */
+    inline void cvtPolygonResult(CvtResult& result, const std::vector<int>& tri_face, int nfaces)
+    {
+        if ((int)tri_face.size() == nfaces || result.face_region.empty())
+            return;
+        std::vector<int> region(nfaces, -1);
+        for(int t = (int)tri_face.size() - 1; t >= 0; t--)
+            region[tri_face[t]] = result.face_region[t];
+        result.face_region.swap(region);
+        for(int r = 0; r < result.num_regions(); r++)
+            result.center_face[r] = tri_face[result.center_face[r]];
+    }
+
+    /* SimpleMesh of triangles or polygons, split in fans of triangles for
+       the CVT: the region of each face is left in m.faceRegions, see
+       cvtPolygonResult. The result is empty when the mesh is malformed.
+       Colors are not touched; see colorRegions. */
+    inline CvtResult computeCVT(SimpleMesh & m, int regions = 20, int iterations = 200, int threads = 1, const Rng& rng = Rng())
+    {
+        std::vector<double> positions;
+        std::vector<int> tris, tri_face;
+        CvtResult result;
+        m.faceRegions.clear();
+        if (!flattenMesh(m, positions, tris, tri_face))
+            return result;
+
+        computeCVT(positions.data(), (int)m.verts.size(), tris.data(), (int)tri_face.size(), result, regions, iterations, threads, rng);
+        cvtPolygonResult(result, tri_face, (int)m.faces.size());
+        m.faceRegions = result.face_region;
+        return result;
+    }
+
+    // one CVT of a CvtBatch
+    struct CvtConfig {
+        int regions;
+        unsigned long long seed;   // of the Rng the seeds are drawn from
+        double alpha;              // weight of positions against normals, as in ILloydCvd
+
+        CvtConfig(int regions_ = 20, unsigned long long seed_ = 0, double alpha_ = 1.0)
+            : regions(regions_), seed(seed_), alpha(alpha_) {}
+    };
+
+    struct CvtRun {
+        CvtConfig config;
+        double energy;       // of the final assignment to the final centers
+        int iterations;      // run, fewer when min_energy_decrease stopped it
+        CvtResult result;
+    };
+
+    /* Many CVTs of one mesh. prepare builds the mesh and the centers,
+       normals and areas of its faces once, and run reads them from every
+       configuration at the same time: each run holds only its own labels
+       and patches, so memory grows with the configurations times the
+       number of faces, not times the mesh. Energies of different alpha
+       weigh positions and normals differently, so only those of equal
+       alpha compare as segmentations; run leaves the ranking to the
+       caller. */
+    class CvtBatch {
+    public:
+        // as in computeCVT; false when the mesh is empty or an index is out of range
+        template<class Real>
+        bool prepare(const Real* positions, int nverts, const int* tris, int nfaces, int threads = 1);
+        // polygons are split as in computeCVT(SimpleMesh&), and the results
+        // are over the faces of m
+        bool prepare(const SimpleMesh & m, int threads = 1);
+
+        /* Runs configs concurrently, each one on a single thread unless
+           there are more threads than configurations, and returns them
+           in the order of configs. With alpha 1 and the defaults of
+           seeding and min_energy_decrease, each result is the one
+           computeCVT gives for the same regions, iterations and Rng(seed). */
+        std::vector<CvtRun> run(const std::vector<CvtConfig>& configs, int iterations = 200, int threads = 1);
+
+        int num_faces() const { return mesh.num_faces(); }   // triangles
+
+        SeedingMethod seeding;          // for every configuration
+        double min_energy_decrease;     // stopping criterion of every run, off when <= 0
+
+        CvtBatch() : seeding(SEED_WEIGHTED), min_energy_decrease(0), polygons(0) {}
+
+    private:
+        CompactMesh mesh;
+        PreparedFaces faces;
+        std::vector<int> polygon_of;   // face of each triangle, when prepared from polygons
+        int polygons;
+    };
+
+    template<class Real>
+    bool CvtBatch::prepare(const Real* positions, int nverts, const int* tris, int nfaces, int threads)
+    {
+        mesh = CompactMesh();
+        polygon_of.clear();
+        polygons = 0;
+        if (!cvt_build_mesh(mesh, positions, nverts, tris, nfaces, 1, threads))
+            return false;
+        faces.build(mesh);
+        return true;
+    }
+
+    inline bool CvtBatch::prepare(const SimpleMesh & m, int threads)
+    {
+        std::vector<double> positions;
+        std::vector<int> tris, tri_face;
+        if (!flattenMesh(m, positions, tris, tri_face))
+        {
+            mesh = CompactMesh();
+            return false;
+        }
+        if (!prepare(positions.data(), (int)m.verts.size(), tris.data(), (int)tri_face.size(), threads))
+            return false;
+        if ((int)tri_face.size() != (int)m.faces.size())
+        {
+            polygon_of.swap(tri_face);
+            polygons = (int)m.faces.size();
+        }
+        return true;
+    }
+
+    inline std::vector<CvtRun> CvtBatch::run(const std::vector<CvtConfig>& configs, int iterations, int threads)
+    {
+        int n = (int)configs.size();
+        std::vector<CvtRun> runs(n);
+        if (n == 0 || mesh.num_faces() == 0)
+            return runs;
+
+        int total = (threads > 0) ? threads : std::max(1, (int)std::thread::hardware_concurrency());
+        int outer = std::min(total, n);
+        int inner = total / outer;
+        ThreadPool pool(outer);
+        pool.parallel_for(n, 1, [&](int begin, int end, int) {
+            for (int i = begin; i < end; i++)
+            {
+                CvtRun& r = runs[i];
+                r.config = configs[i];
+                int regions = std::min(std::max(configs[i].regions, 1), mesh.num_faces());
+
+                LloydCvd cvd(&mesh, faces);
+                cvd.set_num_threads(inner);
+                cvd.alpha = configs[i].alpha;
+                cvd.seeding = seeding;
+                cvd.min_energy_decrease = min_energy_decrease;
+                cvd.rng = Rng(configs[i].seed);
+                cvd.lloyd_euclidean_cvd(&mesh, regions, std::max(iterations, 1));
+
+                r.energy = cvd.labels_energy();
+                r.iterations = (int)cvd.history.size();
+                r.result.resize(mesh.num_faces(), regions);
+                cvt_outputs(cvd, mesh, r.result.face_region.data(), r.result.centers.data(), r.result.normals.data(),
+                    r.result.areas.data(), r.result.center_face.data());
+                if (!polygon_of.empty())
+                    cvtPolygonResult(r.result, polygon_of, polygons);
+            }
+        });
+        return runs;
+    }
+
+    // Color of a region, spread around the hue circle so that neighbouring
+    // indices differ; rgb in [0, 1].
+    inline void regionColor(int region, double rgb[3])
+    {
+        double h = fmod(region * 0.618033988749895, 1.0) * 6;
+        int i = (int)h;
+        double f = h - i, v = 0.95, s = 0.65;
+        double p = v * (1 - s), q = v * (1 - s * f), t = v * (1 - s * (1 - f));
+        double c[6][3] = { {v,t,p}, {q,v,p}, {p,v,t}, {p,q,v}, {t,p,v}, {v,p,q} };
+        for (int k = 0; k < 3; k++) rgb[k] = c[i % 6][k];
+    }
+
+    /* Sets the vertex colors from m.faceRegions for viewing: each vertex
+       takes the color of the region of the last face using it, and
+       vertices of no labelled face are grey. */
+    inline void colorRegions(SimpleMesh & m)
+    {
+        m.vertColor.assign(m.verts.size(), std::vector<double>(3, 0.5));
+        for (int f = 0; f < (int)m.faceRegions.size() && f < (int)m.faces.size(); f++)
+        {
+            if (m.faceRegions[f] < 0)
+                continue;
+            double c[3];
+            regionColor(m.faceRegions[f], c);
+            for (int k = 0; k < (int)m.faces[f].size(); k++)
+                m.vertColor[m.faces[f][k]].assign(c, c + 3);
+        }
     }
 }
@@ -44,6 +44,8 @@ namespace A48 {
 		Hedge h_[2];  // pair of half edges
 
 	public:
+		int index;
+
 		Edge(Vertex *p0, Vertex *p1);
 
 		Hedge* hedge(int i);
@@ -58,7 +60,7 @@ namespace A48 {
 
 
 	/* implementation */
-	Edge::Edge(Vertex *p0, Vertex *p1)
+	Edge::Edge(Vertex *p0, Vertex *p1) : index(-1)
 	{
 		h_[0].set_org(p0); h_[1].set_org(p1);
 		h_[0].set_face(NULL); h_[1].set_face(NULL);;
@@ -0,0 +1,279 @@
+#ifndef ENERGY_KERNEL_H
+#define ENERGY_KERNEL_H
+
+#include <cfloat>
+
+/* Keeps a*b + c from becoming a fused multiply-add, so that every kernel
+   rounds alike: A48_NO_CONTRACT goes before a kernel and A48_FP_EXACT
+   first in its body, for clang, which has no optimize attribute. */
+#if defined(__clang__)
+#  define A48_NO_CONTRACT
+#  define A48_FP_EXACT _Pragma("clang fp contract(off)")
+#elif defined(__GNUC__)
+#  define A48_NO_CONTRACT __attribute__((optimize("fp-contract=off")))
+#  define A48_FP_EXACT
+#else
+#  define A48_NO_CONTRACT
+#  define A48_FP_EXACT
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define A48_X86 1
+#  if defined(__clang__)
+#    define A48_TARGET(isa) __attribute__((target(isa)))
+#  else
+#    define A48_TARGET(isa) __attribute__((target(isa), optimize("fp-contract=off")))
+#  endif
+#  include <immintrin.h>
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#  define A48_X86 1
+#  define A48_TARGET(isa)
+#  include <immintrin.h>
+#  include <intrin.h>
+#endif
+
+namespace A48 {
+
+	/* Face-to-patch energy kernels. Each one scores a face f, given as
+	   { cx, cy, cz, nx, ny, nz }, against the patches stored in the six
+	   arrays p[0..5] (centers then normals) and returns the index of the
+	   first patch of minimum energy
+
+	       wc * |pc - fc|^2 + wn * |pn - fn|^2
+
+	   or -1 when n == 0. The minimum is stored in min_energy. */
+	typedef int (*ArgminEnergyFn)(const double* const* p, int n, const double* f,
+		double wc, double wn, double* min_energy);
+
+	int argmin_energy_scalar(const double* const* p, int n, const double* f,
+		double wc, double wn, double* min_energy);
+
+	// widest kernel supported by the running cpu
+	ArgminEnergyFn select_argmin_energy();
+	const char* argmin_energy_name(ArgminEnergyFn fn);
+	// patches scored per vector, 1 for the scalar kernel
+	int argmin_energy_lanes(ArgminEnergyFn fn);
+
+
+	/* implementation */
+
+	A48_NO_CONTRACT
+	inline int argmin_energy_scalar(const double* const* p, int n, const double* f,
+		double wc, double wn, double* min_energy)
+	{
+		A48_FP_EXACT
+		int best = -1;
+		double best_e = DBL_MAX;
+		for (int i = 0; i < n; i++)
+		{
+			double dx = p[0][i] - f[0], dy = p[1][i] - f[1], dz = p[2][i] - f[2];
+			double ex = p[3][i] - f[3], ey = p[4][i] - f[4], ez = p[5][i] - f[5];
+			double e = wc * (dx*dx + dy*dy + dz*dz) + wn * (ex*ex + ey*ey + ez*ez);
+			if (e < best_e) { best_e = e; best = i; }
+		}
+		if (min_energy) *min_energy = best_e;
+		return best;
+	}
+
+	/* Reduces the per-lane minima of a vector kernel, then finishes the
+	   patches [i, n) that did not fill a whole vector. Equal energies go to
+	   the lowest index so the result matches the scalar kernel. */
+	A48_NO_CONTRACT
+	inline int argmin_energy_finish(const double* lane_e, const double* lane_i, int lanes,
+		const double* const* p, int i, int n, const double* f,
+		double wc, double wn, double* min_energy)
+	{
+		A48_FP_EXACT
+		int best = -1;
+		double best_e = DBL_MAX;
+		for (int l = 0; l < lanes; l++)
+		{
+			int k = (int)lane_i[l];
+			if (k < 0) continue;
+			if (lane_e[l] < best_e || (lane_e[l] == best_e && k < best))
+			{
+				best_e = lane_e[l];
+				best = k;
+			}
+		}
+
+		for (; i < n; i++)
+		{
+			double dx = p[0][i] - f[0], dy = p[1][i] - f[1], dz = p[2][i] - f[2];
+			double ex = p[3][i] - f[3], ey = p[4][i] - f[4], ez = p[5][i] - f[5];
+			double e = wc * (dx*dx + dy*dy + dz*dz) + wn * (ex*ex + ey*ey + ez*ez);
+			if (e < best_e) { best_e = e; best = i; }
+		}
+
+		if (min_energy) *min_energy = best_e;
+		return best;
+	}
+
+#ifdef A48_X86
+
+	A48_TARGET("sse2")
+	inline int argmin_energy_sse2(const double* const* p, int n, const double* f,
+		double wc, double wn, double* min_energy)
+	{
+		A48_FP_EXACT
+		__m128d fcx = _mm_set1_pd(f[0]), fcy = _mm_set1_pd(f[1]), fcz = _mm_set1_pd(f[2]);
+		__m128d fnx = _mm_set1_pd(f[3]), fny = _mm_set1_pd(f[4]), fnz = _mm_set1_pd(f[5]);
+		__m128d vwc = _mm_set1_pd(wc), vwn = _mm_set1_pd(wn);
+		__m128d best = _mm_set1_pd(DBL_MAX), best_i = _mm_set1_pd(-1);
+		__m128d idx = _mm_set_pd(1, 0), step = _mm_set1_pd(2);
+
+		int i = 0;
+		for (; i + 2 <= n; i += 2)
+		{
+			__m128d dx = _mm_sub_pd(_mm_loadu_pd(p[0] + i), fcx);
+			__m128d dy = _mm_sub_pd(_mm_loadu_pd(p[1] + i), fcy);
+			__m128d dz = _mm_sub_pd(_mm_loadu_pd(p[2] + i), fcz);
+			__m128d ex = _mm_sub_pd(_mm_loadu_pd(p[3] + i), fnx);
+			__m128d ey = _mm_sub_pd(_mm_loadu_pd(p[4] + i), fny);
+			__m128d ez = _mm_sub_pd(_mm_loadu_pd(p[5] + i), fnz);
+			__m128d d = _mm_add_pd(_mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy)), _mm_mul_pd(dz, dz));
+			__m128d g = _mm_add_pd(_mm_add_pd(_mm_mul_pd(ex, ex), _mm_mul_pd(ey, ey)), _mm_mul_pd(ez, ez));
+			__m128d e = _mm_add_pd(_mm_mul_pd(vwc, d), _mm_mul_pd(vwn, g));
+
+			__m128d lt = _mm_cmplt_pd(e, best);
+			best = _mm_or_pd(_mm_and_pd(lt, e), _mm_andnot_pd(lt, best));
+			best_i = _mm_or_pd(_mm_and_pd(lt, idx), _mm_andnot_pd(lt, best_i));
+			idx = _mm_add_pd(idx, step);
+		}
+
+		double lane_e[2], lane_i[2];
+		_mm_storeu_pd(lane_e, best);
+		_mm_storeu_pd(lane_i, best_i);
+		return argmin_energy_finish(lane_e, lane_i, 2, p, i, n, f, wc, wn, min_energy);
+	}
+
+	A48_TARGET("avx2")
+	inline int argmin_energy_avx2(const double* const* p, int n, const double* f,
+		double wc, double wn, double* min_energy)
+	{
+		A48_FP_EXACT
+		__m256d fcx = _mm256_set1_pd(f[0]), fcy = _mm256_set1_pd(f[1]), fcz = _mm256_set1_pd(f[2]);
+		__m256d fnx = _mm256_set1_pd(f[3]), fny = _mm256_set1_pd(f[4]), fnz = _mm256_set1_pd(f[5]);
+		__m256d vwc = _mm256_set1_pd(wc), vwn = _mm256_set1_pd(wn);
+		__m256d best = _mm256_set1_pd(DBL_MAX), best_i = _mm256_set1_pd(-1);
+		__m256d idx = _mm256_set_pd(3, 2, 1, 0), step = _mm256_set1_pd(4);
+
+		int i = 0;
+		for (; i + 4 <= n; i += 4)
+		{
+			__m256d dx = _mm256_sub_pd(_mm256_loadu_pd(p[0] + i), fcx);
+			__m256d dy = _mm256_sub_pd(_mm256_loadu_pd(p[1] + i), fcy);
+			__m256d dz = _mm256_sub_pd(_mm256_loadu_pd(p[2] + i), fcz);
+			__m256d ex = _mm256_sub_pd(_mm256_loadu_pd(p[3] + i), fnx);
+			__m256d ey = _mm256_sub_pd(_mm256_loadu_pd(p[4] + i), fny);
+			__m256d ez = _mm256_sub_pd(_mm256_loadu_pd(p[5] + i), fnz);
+			__m256d d = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)), _mm256_mul_pd(dz, dz));
+			__m256d g = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ex, ex), _mm256_mul_pd(ey, ey)), _mm256_mul_pd(ez, ez));
+			__m256d e = _mm256_add_pd(_mm256_mul_pd(vwc, d), _mm256_mul_pd(vwn, g));
+
+			__m256d lt = _mm256_cmp_pd(e, best, _CMP_LT_OQ);
+			best = _mm256_blendv_pd(best, e, lt);
+			best_i = _mm256_blendv_pd(best_i, idx, lt);
+			idx = _mm256_add_pd(idx, step);
+		}
+
+		double lane_e[4], lane_i[4];
+		_mm256_storeu_pd(lane_e, best);
+		_mm256_storeu_pd(lane_i, best_i);
+		return argmin_energy_finish(lane_e, lane_i, 4, p, i, n, f, wc, wn, min_energy);
+	}
+
+	A48_TARGET("avx512f")
+	inline int argmin_energy_avx512(const double* const* p, int n, const double* f,
+		double wc, double wn, double* min_energy)
+	{
+		A48_FP_EXACT
+		__m512d fcx = _mm512_set1_pd(f[0]), fcy = _mm512_set1_pd(f[1]), fcz = _mm512_set1_pd(f[2]);
+		__m512d fnx = _mm512_set1_pd(f[3]), fny = _mm512_set1_pd(f[4]), fnz = _mm512_set1_pd(f[5]);
+		__m512d vwc = _mm512_set1_pd(wc), vwn = _mm512_set1_pd(wn);
+		__m512d best = _mm512_set1_pd(DBL_MAX), best_i = _mm512_set1_pd(-1);
+		__m512d idx = _mm512_set_pd(7, 6, 5, 4, 3, 2, 1, 0), step = _mm512_set1_pd(8);
+
+		int i = 0;
+		for (; i + 8 <= n; i += 8)
+		{
+			__m512d dx = _mm512_sub_pd(_mm512_loadu_pd(p[0] + i), fcx);
+			__m512d dy = _mm512_sub_pd(_mm512_loadu_pd(p[1] + i), fcy);
+			__m512d dz = _mm512_sub_pd(_mm512_loadu_pd(p[2] + i), fcz);
+			__m512d ex = _mm512_sub_pd(_mm512_loadu_pd(p[3] + i), fnx);
+			__m512d ey = _mm512_sub_pd(_mm512_loadu_pd(p[4] + i), fny);
+			__m512d ez = _mm512_sub_pd(_mm512_loadu_pd(p[5] + i), fnz);
+			__m512d d = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(dx, dx), _mm512_mul_pd(dy, dy)), _mm512_mul_pd(dz, dz));
+			__m512d g = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(ex, ex), _mm512_mul_pd(ey, ey)), _mm512_mul_pd(ez, ez));
+			__m512d e = _mm512_add_pd(_mm512_mul_pd(vwc, d), _mm512_mul_pd(vwn, g));
+
+			__mmask8 lt = _mm512_cmp_pd_mask(e, best, _CMP_LT_OQ);
+			best = _mm512_mask_blend_pd(lt, best, e);
+			best_i = _mm512_mask_blend_pd(lt, best_i, idx);
+			idx = _mm512_add_pd(idx, step);
+		}
+
+		double lane_e[8], lane_i[8];
+		_mm512_storeu_pd(lane_e, best);
+		_mm512_storeu_pd(lane_i, best_i);
+		return argmin_energy_finish(lane_e, lane_i, 8, p, i, n, f, wc, wn, min_energy);
+	}
+
+	inline bool cpu_has(const char* isa)
+	{
+#if defined(_MSC_VER)
+		int r[4];
+		__cpuid(r, 0);
+		if (r[0] < 7) return false;
+		__cpuid(r, 1);
+		bool osxsave = (r[2] & (1 << 27)) != 0;
+		unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+		__cpuidex(r, 7, 0);
+		if (isa[3] == '5') // avx512f
+			return (xcr0 & 0xe6) == 0xe6 && (r[1] & (1 << 16)) != 0;
+		if (isa[0] == 'a') // avx2
+			return (xcr0 & 0x6) == 0x6 && (r[1] & (1 << 5)) != 0;
+		return true;
+#else
+		__builtin_cpu_init();
+		if (isa[3] == '5') return __builtin_cpu_supports("avx512f") != 0;
+		if (isa[0] == 'a') return __builtin_cpu_supports("avx2") != 0;
+		return __builtin_cpu_supports("sse2") != 0;
+#endif
+	}
+
+#endif
+
+	inline ArgminEnergyFn select_argmin_energy()
+	{
+#ifdef A48_X86
+		if (cpu_has("avx512f")) return &argmin_energy_avx512;
+		if (cpu_has("avx2")) return &argmin_energy_avx2;
+		if (cpu_has("sse2")) return &argmin_energy_sse2;
+#endif
+		return &argmin_energy_scalar;
+	}
+
+	inline const char* argmin_energy_name(ArgminEnergyFn fn)
+	{
+#ifdef A48_X86
+		if (fn == &argmin_energy_avx512) return "avx512";
+		if (fn == &argmin_energy_avx2) return "avx2";
+		if (fn == &argmin_energy_sse2) return "sse2";
+#endif
+		return "scalar";
+	}
+
+	inline int argmin_energy_lanes(ArgminEnergyFn fn)
+	{
+#ifdef A48_X86
+		if (fn == &argmin_energy_avx512) return 8;
+		if (fn == &argmin_energy_avx2) return 4;
+		if (fn == &argmin_energy_sse2) return 2;
+#endif
+		return 1;
+	}
+
+}
+
+#endif
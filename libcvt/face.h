@@ -14,26 +14,10 @@ namespace A48 {
 		int index;
 
 		Face(Hedge* e0, Hedge* e1, Hedge* e2) { reuse(e0, e1, e2); density_ = 1.0; area_ = distance_ = 0.0; p_ = nullptr; parent_ = nullptr; }
-		Face(Hedge* e0, Hedge* e1, Hedge* e2, float v0, float v1, float v2, float v3, float v4, float v5) {
-			reuse(e0, e1, e2);
-
-			coordText[0][0] = v0;
-			coordText[0][1] = v1;
-			coordText[1][0] = v2;
-			coordText[1][1] = v3;
-			coordText[2][0] = v4;
-			coordText[2][1] = v5;
-
-			density_ = 1.0;
-			area_ =  distance_ = 0.0;
-			p_ = nullptr;
-			parent_ = nullptr;
-		};
 
         Patch* patch() { return p_;}
 		Hedge* hedge(int k);
 		Vertex* vertex(int k);
-		Vector3 coordText[3];
 
 		Vector3 normal_;
 		double area_;
@@ -57,12 +41,10 @@ namespace A48 {
 		void calculate_normal();
 		void calculate_center();
 		void calculate_area();
-		double get_mean_curv();
 
 		void set_patch(Patch* p) {p_ = p;};
 		void set_hedge(int k, Hedge* h);
 		void set_vertex(int k, Vertex* v);
-		void set_coordText(int k, Vector3 v);
 
 		void link_star_verts();
 
@@ -94,15 +76,6 @@ namespace A48 {
 		//throw Error("hedge index");
 	}
 
-	double Face::get_mean_curv()
-	{
-		Vertex* v0 = vertex(0);
-		Vertex* v1 = vertex(1);
-		Vertex* v2 = vertex(2);
-
-		return 1/3. * ( v0->a.mean_curvature + v1->a.mean_curvature + v2->a.mean_curvature );
-	}
-
 
 	void Face::calculate_center()
 	{
@@ -170,12 +143,6 @@ namespace A48 {
 		hedge(PREV3(k))->set_org(v);
 	}
 
-	void  Face::set_coordText(int k, Vector3 v)
-	{
-		coordText[k] = v;
-	}
-
-
     int Hedge::getIndexMate()
     {
         if (this->mate()->face() != NULL)
@@ -0,0 +1,239 @@
+#ifndef FACE_BUFFERS_H
+#define FACE_BUFFERS_H
+
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "a48.h"
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+namespace A48 {
+
+	/* Fixed-capacity array aligned to a cache line, for the packed buffers
+	   read by the Lloyd loop. Growing keeps the current contents. */
+	template<class T>
+	class AlignedArray {
+	public:
+		enum { ALIGNMENT = 64 };
+
+		AlignedArray() : data_(0), size_(0), capacity_(0) {}
+		~AlignedArray() { release(data_); }
+
+		void resize(size_t n);
+		void fill(const T& v) { for (size_t i = 0; i < size_; i++) data_[i] = v; }
+
+		size_t size() const { return size_; }
+		T*       data()       { return data_; }
+		const T* data() const { return data_; }
+
+		T&       operator[](size_t i)       { return data_[i]; }
+		const T& operator[](size_t i) const { return data_[i]; }
+
+	private:
+		AlignedArray(const AlignedArray&);
+		AlignedArray& operator=(const AlignedArray&);
+
+		static T* allocate(size_t n)
+		{
+#ifdef _WIN32
+			return (T*)_aligned_malloc(n * sizeof(T), ALIGNMENT);
+#else
+			void* p = 0;
+			if (posix_memalign(&p, ALIGNMENT, n * sizeof(T)) != 0) return 0;
+			return (T*)p;
+#endif
+		}
+
+		static void release(T* p)
+		{
+#ifdef _WIN32
+			_aligned_free(p);
+#else
+			free(p);
+#endif
+		}
+
+		T* data_;
+		size_t size_;
+		size_t capacity_;
+	};
+
+	/* Structure-of-arrays snapshot of the face data used by the Lloyd loop:
+	   center, normal and weight (area times density) of every face, in the
+	   order of the face list the snapshot was built from. */
+	struct FaceBuffers {
+		AlignedArray<double> cx, cy, cz;
+		AlignedArray<double> nx, ny, nz;
+		AlignedArray<double> w;
+
+		int size() const { return (int)w.size(); }
+
+		void resize(size_t n);
+		void build(const std::vector<Face*>& faces);
+		void build(CompactMesh& mesh);   // faces in index order, density 1
+	};
+
+	/* Same layout for the patch centers and normals, indexed by patch index. */
+	struct PatchBuffers {
+		AlignedArray<double> cx, cy, cz;
+		AlignedArray<double> nx, ny, nz;
+		std::vector<int> center_face;   // position in the face list
+
+		int size() const { return (int)center_face.size(); }
+
+		void resize(size_t n);
+		void assign(const PatchBuffers& p);   // copy of p
+	};
+
+
+	/* Compressed adjacency lists: the neighbours of node i are
+	   adj[offsets[i]] .. adj[offsets[i+1] - 1]. */
+	struct Adjacency {
+		std::vector<int> offsets;
+		std::vector<int> adj;
+
+		int size() const { return offsets.empty() ? 0 : (int)offsets.size() - 1; }
+		const int* begin(int i) const { return adj.data() + offsets[i]; }
+		const int* end(int i) const { return adj.data() + offsets[i+1]; }
+	};
+
+	// faces sharing an edge, as positions in the face list
+	void build_face_adjacency(const std::vector<Face*>& faces, Adjacency& g);
+	void build_face_adjacency(const CompactMesh& mesh, Adjacency& g);
+
+	/* Face buffers and face graph of a mesh. Runs over the mesh only read
+	   them, so one copy built up front can serve many runs at once. */
+	struct PreparedFaces {
+		FaceBuffers faces;
+		Adjacency graph;
+
+		void build(CompactMesh& mesh);
+	};
+
+
+	/* implementation */
+
+	template<class T>
+	void AlignedArray<T>::resize(size_t n)
+	{
+		if (n > capacity_)
+		{
+			T* p = allocate(n);
+			if (size_ > 0) memcpy(p, data_, size_ * sizeof(T));
+			release(data_);
+			data_ = p;
+			capacity_ = n;
+		}
+		size_ = n;
+	}
+
+	inline void FaceBuffers::resize(size_t n)
+	{
+		cx.resize(n); cy.resize(n); cz.resize(n);
+		nx.resize(n); ny.resize(n); nz.resize(n);
+		w.resize(n);
+	}
+
+	inline void FaceBuffers::build(const std::vector<Face*>& faces)
+	{
+		resize(faces.size());
+		for (size_t i = 0; i < faces.size(); i++)
+		{
+			Face& f = *faces[i];
+			cx[i] = f.center().x; cy[i] = f.center().y; cz[i] = f.center().z;
+			nx[i] = f.normal().x; ny[i] = f.normal().y; nz[i] = f.normal().z;
+			w[i] = f.area() * f.density();
+		}
+	}
+
+	inline void FaceBuffers::build(CompactMesh& mesh)
+	{
+		int n = mesh.num_faces();
+		resize(n);
+		for (int i = 0; i < n; i++)
+		{
+			Vector3 c = mesh.face_center(i);
+			Vector3 nn = mesh.face_normal(i);
+			cx[i] = c.x; cy[i] = c.y; cz[i] = c.z;
+			nx[i] = nn.x; ny[i] = nn.y; nz[i] = nn.z;
+			w[i] = mesh.face_area(i);
+		}
+	}
+
+	inline void build_face_adjacency(const std::vector<Face*>& faces, Adjacency& g)
+	{
+		int max_index = -1;
+		for (size_t i = 0; i < faces.size(); i++)
+			max_index = std::max(max_index, faces[i]->get_index());
+
+		std::vector<int> pos(max_index + 1, -1);
+		for (size_t i = 0; i < faces.size(); i++)
+			pos[faces[i]->get_index()] = (int)i;
+
+		g.offsets.resize(faces.size() + 1);
+		g.adj.clear();
+		g.adj.reserve(3 * faces.size());
+		for (size_t i = 0; i < faces.size(); i++)
+		{
+			g.offsets[i] = (int)g.adj.size();
+			for (int k = 0; k < 3; k++)
+			{
+				Face* n = faces[i]->hedge(k)->mate()->face();
+				if (n != NULL && pos[n->get_index()] >= 0)
+					g.adj.push_back(pos[n->get_index()]);
+			}
+		}
+		g.offsets[faces.size()] = (int)g.adj.size();
+	}
+
+	inline void build_face_adjacency(const CompactMesh& mesh, Adjacency& g)
+	{
+		int n = mesh.num_faces();
+		g.offsets.resize(n + 1);
+		g.adj.clear();
+		g.adj.reserve(3 * n);
+		for (int i = 0; i < n; i++)
+		{
+			g.offsets[i] = (int)g.adj.size();
+			for (int k = 0; k < 3; k++)
+			{
+				int h = mesh.mate(3*i + k);
+				if (h >= 0)
+					g.adj.push_back(CompactMesh::face(h));
+			}
+		}
+		g.offsets[n] = (int)g.adj.size();
+	}
+
+	inline void PreparedFaces::build(CompactMesh& mesh)
+	{
+		faces.build(mesh);
+		build_face_adjacency(mesh, graph);
+	}
+
+	inline void PatchBuffers::resize(size_t n)
+	{
+		cx.resize(n); cy.resize(n); cz.resize(n);
+		nx.resize(n); ny.resize(n); nz.resize(n);
+		center_face.resize(n);
+	}
+
+	inline void PatchBuffers::assign(const PatchBuffers& p)
+	{
+		resize(p.size());
+		std::copy(p.cx.data(), p.cx.data() + p.size(), cx.data());
+		std::copy(p.cy.data(), p.cy.data() + p.size(), cy.data());
+		std::copy(p.cz.data(), p.cz.data() + p.size(), cz.data());
+		std::copy(p.nx.data(), p.nx.data() + p.size(), nx.data());
+		std::copy(p.ny.data(), p.ny.data() + p.size(), ny.data());
+		std::copy(p.nz.data(), p.nz.data() + p.size(), nz.data());
+		center_face = p.center_face;
+	}
+
+}
+
+#endif
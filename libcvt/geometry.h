@@ -4,9 +4,12 @@
 #include <iostream>
 #include <fstream>
 
+#include <cfloat>
 #include <cmath>
 #include <iostream>
 
+#include "random.h"
+
 using namespace std;
 
 #define INF DBL_MAX
@@ -66,7 +69,6 @@ class Vector3
 
 		Vector3( real _x = 0, real _y = 0, real _z = 0);
 		Vector3( const Vector3& v );
-		~Vector3();
 
 		bool normalize();
 		real norm();
@@ -161,7 +163,8 @@ public:
     }
 };
 
-real random1();
+// uniform in [0, 1) from the next draw of rng
+real random1(A48::Rng& rng);
 
 
 
@@ -284,10 +287,6 @@ Vector3::Vector3( const Vector3& v ) : x(v.x), y(v.y), z(v.z)
 {
 }
 
-Vector3::~Vector3()
-{
-}
-
 real Vector3::norm()
 {
 	return sqrt( norm2() );
@@ -417,10 +416,9 @@ real seg_distance(Vector3 p, Vector3 q, Vector3 r)
    else return fabs((A % B).z) / sqrt(c);
 }
 
-real random1()
+real random1(A48::Rng& rng)
 {
-	const int mm = 99999;
-    return ( rand() % mm ) / (real) mm;
+    return rng.next_uniform();
 }
 
 #endif
@@ -157,7 +157,7 @@ public:
 
 	uint add()
 	{
-		if( length()==total_space() ) resize(total_space() * 2);
+		if( length()==total_space() ) MxBlock<T>::resize(total_space() * 2);
 		return fill++;
 	}
 	uint add(const T& t)
@@ -0,0 +1,101 @@
+#ifndef INDEXED_CONTAINER_H
+#define INDEXED_CONTAINER_H
+
+#include <cstddef>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+namespace A48 {
+
+	/* Set of element pointers stored in a vector at the position given by
+	   each element's index field. Drop-in replacement for the std::set
+	   containers of the mesh when A48_INDEXED_CONTAINERS is defined:
+	   iteration follows the indices, so it is deterministic and sequential,
+	   and at(i) is O(1). Erased elements leave an empty slot behind that
+	   iteration skips. */
+	template<class T>
+	class IndexedContainer {
+	public:
+		class iterator {
+		public:
+			typedef std::forward_iterator_tag iterator_category;
+			typedef T* value_type;
+			typedef std::ptrdiff_t difference_type;
+			typedef T* const* pointer;
+			typedef T* const& reference;
+
+			iterator() : p_(0), end_(0) {}
+			iterator(T* const* p, T* const* end) : p_(p), end_(end) { skip(); }
+
+			reference operator*() const { return *p_; }
+			iterator& operator++() { ++p_; skip(); return *this; }
+			iterator operator++(int) { iterator r = *this; ++*this; return r; }
+			bool operator==(const iterator& o) const { return p_ == o.p_; }
+			bool operator!=(const iterator& o) const { return p_ != o.p_; }
+
+		private:
+			void skip() { while (p_ != end_ && *p_ == 0) ++p_; }
+			T* const* p_;
+			T* const* end_;
+		};
+		typedef iterator const_iterator;
+
+		IndexedContainer() : count_(0) {}
+
+		iterator begin() const { return iterator(slots_.data(), slots_.data() + slots_.size()); }
+		iterator end() const { return iterator(slots_.data() + slots_.size(), slots_.data() + slots_.size()); }
+
+		size_t size() const { return count_; }
+		bool empty() const { return count_ == 0; }
+
+		// number of slots, that is one past the largest index in use
+		int slots() const { return (int)slots_.size(); }
+		// element of index i, NULL for an empty slot
+		T* at(int i) const { return (i >= 0 && i < (int)slots_.size()) ? slots_[i] : 0; }
+		// slot array, without holes when nothing was erased
+		const std::vector<T*>& elements() const { return slots_; }
+
+		std::pair<iterator, bool> insert(T* p);
+		size_t erase(T* p);
+		void clear() { slots_.clear(); count_ = 0; }
+		void reserve(size_t n) { slots_.reserve(n); }
+
+	private:
+		iterator at_slot(int i) const { return iterator(slots_.data() + i, slots_.data() + slots_.size()); }
+
+		std::vector<T*> slots_;
+		size_t count_;
+	};
+
+
+	/* implementation */
+
+	/* The element goes to slot p->index. Like a duplicate in a std::set,
+	   the insertion fails if that slot already holds an element. */
+	template<class T>
+	std::pair<typename IndexedContainer<T>::iterator, bool> IndexedContainer<T>::insert(T* p)
+	{
+		int i = p->index;
+		if (i < 0) return std::make_pair(end(), false);
+		if (i >= (int)slots_.size()) slots_.resize(i + 1, (T*)0);
+		if (slots_[i] != 0) return std::make_pair(at_slot(i), false);
+		slots_[i] = p;
+		count_++;
+		return std::make_pair(at_slot(i), true);
+	}
+
+	template<class T>
+	size_t IndexedContainer<T>::erase(T* p)
+	{
+		int i = p->index;
+		if (i < 0 || i >= (int)slots_.size() || slots_[i] != p) return 0;
+		slots_[i] = 0;
+		count_--;
+		while (!slots_.empty() && slots_.back() == 0) slots_.pop_back();
+		return 1;
+	}
+
+}
+
+#endif
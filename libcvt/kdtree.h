@@ -0,0 +1,150 @@
+#ifndef KDTREE_H
+#define KDTREE_H
+
+#include <vector>
+#include <algorithm>
+#include <cfloat>
+
+namespace A48 {
+
+	/* Static kd-tree over points of dimension D, used as a nearest-center
+	   index over the patches. The tree is rebuilt from scratch with build()
+	   and its buffers are reused between builds. */
+	template<int D>
+	class KdTree {
+	public:
+		KdTree() : n_(0) {}
+
+		void build(const std::vector<double>& points);
+		int nearest(const double* q, double* dist2, long long* evaluations = 0) const;
+		int size() const { return n_; }
+
+	private:
+		enum { LEAF_SIZE = 8 };
+
+		struct Node {
+			int lo, hi;   // range in perm_
+			int axis;     // split axis, -1 for leaves
+			double split;
+		};
+
+		int n_;
+		std::vector<double> pts_;   // points in tree order
+		std::vector<int> perm_;     // tree order -> original index
+		std::vector<Node> nodes_;   // implicit binary tree, root at 0
+
+		void build_node(int node, int lo, int hi);
+		void search(int node, const double* q, int& best, double& best_d2, long long& evaluations) const;
+
+		double dist2(int i, const double* q) const
+		{
+			const double* p = &pts_[i*D];
+			double d = 0;
+			for (int k = 0; k < D; k++) d += (p[k] - q[k]) * (p[k] - q[k]);
+			return d;
+		}
+	};
+
+
+	/* implementation */
+
+	template<int D>
+	void KdTree<D>::build(const std::vector<double>& points)
+	{
+		n_ = (int)points.size() / D;
+		pts_ = points;
+		perm_.resize(n_);
+		for (int i = 0; i < n_; i++) perm_[i] = i;
+
+		int leaves = 1;
+		while (leaves * LEAF_SIZE < n_) leaves *= 2;
+		nodes_.resize(2 * leaves);
+
+		if (n_ > 0) build_node(0, 0, n_);
+
+		// reorder the points so that leaf scans are sequential
+		for (int i = 0; i < n_; i++)
+			for (int k = 0; k < D; k++)
+				pts_[i*D + k] = points[perm_[i]*D + k];
+	}
+
+	template<int D>
+	void KdTree<D>::build_node(int node, int lo, int hi)
+	{
+		Node& nd = nodes_[node];
+		nd.lo = lo; nd.hi = hi;
+
+		if (hi - lo <= LEAF_SIZE || 2*node + 2 >= (int)nodes_.size())
+		{
+			nd.axis = -1;
+			return;
+		}
+
+		// split along the axis of largest spread
+		double lo_k[D], hi_k[D];
+		for (int k = 0; k < D; k++) { lo_k[k] = DBL_MAX; hi_k[k] = -DBL_MAX; }
+		for (int i = lo; i < hi; i++)
+			for (int k = 0; k < D; k++)
+			{
+				double x = pts_[perm_[i]*D + k];
+				lo_k[k] = std::min(lo_k[k], x);
+				hi_k[k] = std::max(hi_k[k], x);
+			}
+		int axis = 0;
+		for (int k = 1; k < D; k++)
+			if (hi_k[k] - lo_k[k] > hi_k[axis] - lo_k[axis]) axis = k;
+
+		int mid = (lo + hi) / 2;
+		const std::vector<double>& p = pts_;
+		std::nth_element(perm_.begin() + lo, perm_.begin() + mid, perm_.begin() + hi,
+			[&p, axis](int a, int b) { return p[a*D + axis] < p[b*D + axis]; });
+
+		nd.axis = axis;
+		nd.split = pts_[perm_[mid]*D + axis];
+
+		build_node(2*node + 1, lo, mid);
+		build_node(2*node + 2, mid, hi);
+	}
+
+	/* Returns the original index of the point closest to q, or -1 if the
+	   tree is empty. The squared distance is stored in dist2, and the number
+	   of distances computed on the way is added to evaluations. */
+	template<int D>
+	int KdTree<D>::nearest(const double* q, double* d2, long long* evaluations) const
+	{
+		int best = -1;
+		double best_d2 = DBL_MAX;
+		long long count = 0;
+		if (n_ > 0) search(0, q, best, best_d2, count);
+		if (d2) *d2 = best_d2;
+		if (evaluations) *evaluations += count;
+		return (best < 0)? -1 : perm_[best];
+	}
+
+	template<int D>
+	void KdTree<D>::search(int node, const double* q, int& best, double& best_d2, long long& evaluations) const
+	{
+		const Node& nd = nodes_[node];
+		if (nd.axis < 0)
+		{
+			evaluations += nd.hi - nd.lo;
+			for (int i = nd.lo; i < nd.hi; i++)
+			{
+				double d = dist2(i, q);
+				if (d < best_d2) { best_d2 = d; best = i; }
+			}
+			return;
+		}
+
+		double diff = q[nd.axis] - nd.split;
+		int near_child = (diff < 0)? 2*node + 1 : 2*node + 2;
+		int far_child = (diff < 0)? 2*node + 2 : 2*node + 1;
+
+		search(near_child, q, best, best_d2, evaluations);
+		if (diff * diff < best_d2)
+			search(far_child, q, best, best_d2, evaluations);
+	}
+
+}
+
+#endif
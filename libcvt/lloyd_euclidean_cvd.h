@@ -2,49 +2,300 @@
 #define LLOYD_EUCLIDEAN_CVD_INCLUDED 
 
 #include "mesh_geometry.h"
+#include "kdtree.h"
+#include "thread_pool.h"
+#include "face_buffers.h"
+#include "energy_kernel.h"
+#include "seeding.h"
+#include "simplify.h"
+
+#include <chrono>
+#include <queue>
 
 using namespace A48;
 
+// The Lloyd loop is silent; defining A48_LOGGING prints a line per
+// iteration and per warning. The same figures are always available
+// through CvdObserver.
+#ifdef A48_LOGGING
+#define CVD_LOG(x) (cout << x << '\n')
+#else
+#define CVD_LOG(x)
+#endif
+
+enum CvdStopReason
+{
+	STOP_ITERATIONS,    // ran the requested number of iterations
+	STOP_CONVERGED,     // no face changed region, so the centers are fixed
+	STOP_REASSIGNED,    // few enough faces changed region
+	STOP_ENERGY,        // the energy stopped decreasing
+	STOP_DISPLACEMENT   // the centers stopped moving
+};
+
+struct CvdIterationStats
+{
+	int reassigned;           // faces that changed region
+	double energy;            // total energy of the assignment
+	double max_displacement;  // largest center move, relative to bbox_diagonal
+	long long energy_evaluations;  // face to center energies in update_regions
+	long long regions_ns;          // time in update_regions
+	long long centroids_ns;        // time in update_centroids
+	int min_patch_size;            // faces in the smallest and largest patch
+	int max_patch_size;
+};
+
+class ILloydCvd;
+
+/* Receives the statistics of every iteration as lloyd_euclidean_cvd runs,
+   on the calling thread and between iterations, so it may read the
+   current labels and centers of cvd. */
+class CvdObserver
+{
+	public:
+		virtual ~CvdObserver() {}
+		virtual void on_iteration(const ILloydCvd& cvd, int iteration, const CvdIterationStats& s) = 0;
+		virtual void on_finish(const ILloydCvd& /*cvd*/, CvdStopReason /*reason*/) {}
+};
+
 class ILloydCvd
 {
 	public:
 		double alpha;
 		Mesh* mesh;
+		CompactMesh* compact_mesh;   // set instead of mesh by the CompactMesh constructor
 		double bbox_diagonal;
 
-		ILloydCvd(Mesh* mesh_) : mesh(mesh_), alpha(1.0)
+		// stopping criteria of lloyd_euclidean_cvd, each one disabled when <= 0
+		double max_reassigned_fraction;   // of the faces
+		double min_energy_decrease;       // relative to the previous iteration
+		double max_displacement;          // relative to bbox_diagonal
+
+		SeedingMethod seeding;               // how the first centers are picked
+		Rng rng;                             // seeding draws start at its counter every run
+		CvdObserver* observer;               // told about every iteration, not owned
+
+		vector<CvdIterationStats> history;   // one entry per iteration run
+		CvdStopReason stop_reason;
+
+		ILloydCvd(Mesh* mesh_) : alpha(1.0), mesh(mesh_), compact_mesh(NULL),
+			max_reassigned_fraction(0), min_energy_decrease(0), max_displacement(0), seeding(SEED_WEIGHTED), observer(NULL),
+			stop_reason(STOP_ITERATIONS), pool(new ThreadPool(1)),
+			face_data(own_faces.faces), face_graph(own_faces.graph), shared_faces(false),
+			region_passes(0), region_energy(0), centroid_displacement(0),
+			energy_evaluations(0), min_patch_size(0), max_patch_size(0)
 		{
 			bbox_diagonal = MeshGeometry::get_diameter( *mesh_ );
+			distance_scale = 2.0 / bbox_diagonal;
+			argmin_energy = select_argmin_energy();
 		}
+		ILloydCvd(CompactMesh* mesh_) : alpha(1.0), mesh(NULL), compact_mesh(mesh_),
+			max_reassigned_fraction(0), min_energy_decrease(0), max_displacement(0), seeding(SEED_WEIGHTED), observer(NULL),
+			stop_reason(STOP_ITERATIONS), pool(new ThreadPool(1)),
+			face_data(own_faces.faces), face_graph(own_faces.graph), shared_faces(false),
+			region_passes(0), region_energy(0), centroid_displacement(0),
+			energy_evaluations(0), min_patch_size(0), max_patch_size(0)
+		{
+			bbox_diagonal = MeshGeometry::get_diameter( *mesh_ );
+			distance_scale = 2.0 / bbox_diagonal;
+			argmin_energy = select_argmin_energy();
+		}
+		// reads the faces of mesh from shared, built beforehand and left
+		// alone, instead of building its own; lloyd_multilevel_cvd, which
+		// needs other meshes, then runs on mesh alone
+		ILloydCvd(CompactMesh* mesh_, const PreparedFaces& shared) : alpha(1.0), mesh(NULL), compact_mesh(mesh_),
+			max_reassigned_fraction(0), min_energy_decrease(0), max_displacement(0), seeding(SEED_WEIGHTED), observer(NULL),
+			stop_reason(STOP_ITERATIONS), pool(new ThreadPool(1)),
+			face_data(shared.faces), face_graph(shared.graph), shared_faces(true),
+			region_passes(0), region_energy(0), centroid_displacement(0),
+			energy_evaluations(0), min_patch_size(0), max_patch_size(0)
+		{
+			bbox_diagonal = MeshGeometry::get_diameter( *mesh_ );
+			distance_scale = 2.0 / bbox_diagonal;
+			argmin_energy = select_argmin_energy();
+		}
+		virtual ~ILloydCvd() { delete pool; }
+
+		// number of threads used by the region assignment, 0 for all cores
+		void set_num_threads(int n) { delete pool; pool = new ThreadPool(n); }
+		int num_threads() const { return pool->size(); }
+		ThreadPool* thread_pool() { return pool; }
 
+		// update_regions and update_centroids work on the packed buffers
+		// built here; write_back copies the result to the mesh
 		void initialize_centroids(Mesh* mesh, int k);
-		virtual void update_regions(Mesh* mesh) = 0;
+		void initialize_centroids(CompactMesh* mesh, int k);
+		// starts from given centers instead of seeds, each one on the face
+		// of mesh with the nearest center that no other center took
+		void initialize_centroids(CompactMesh* mesh, const PatchBuffers& centers);
+		// returns the number of faces that changed region, and leaves the
+		// total energy of the new assignment in region_energy and the
+		// energies computed in energy_evaluations
+		virtual int update_regions(Mesh* mesh) = 0;
+		// leaves the largest center move in centroid_displacement and the
+		// patch sizes in min_patch_size and max_patch_size
 		virtual void update_centroids(Mesh* mesh) = 0;
+		// euclidean energy of the current labels against the current
+		// centers; the history has it before the last centroid update
+		double labels_energy();
+		void write_back(Mesh* mesh);
 	
 		void lloyd_euclidean_cvd(Mesh* mesh, int regions, int iterations );
+		// on a CompactMesh the result stays in face_labels and region_data
+		void lloyd_euclidean_cvd(CompactMesh* mesh, int regions, int iterations );
+		// same, coarse to fine; see the definition
+		void lloyd_multilevel_cvd(CompactMesh* mesh, int regions, int iterations, int refine_iterations,
+			int coarsest_faces = 0 );
+		static const char* stop_reason_name(CvdStopReason r);
+
+		// region of each face in face order, and center face (a face
+		// index), center and normal of each region
+		const vector<int>& face_labels() const { return labels; }
+		const PatchBuffers& region_data() const { return patch_data; }
 	
 	protected:
+		void seed_patches(int k);
+		void run_iterations(Mesh* mesh, int iterations);
+		bool should_stop(const CvdIterationStats& s);
+		double sum_chunk_energy();
+
 		double get_energy(Patch& p, Face& f);
+		double get_energy(int p, int f);
 		Face* project_to_region(vector<Face*>& faces, Vector3 c);
+		int nearest_free_face(const double* q, int start);
 		void print_centroids(Mesh* mesh);
+
+		enum { FACE_CHUNK = 1024 };
+
+		ThreadPool* pool;
+		ArgminEnergyFn argmin_energy;   // simd kernel picked for this cpu
+		double distance_scale;          // 2 / bbox_diagonal
+
+		vector<Face*> faces;      // face list, position i is face_data[i]
+		vector<Patch*> patches;   // patch of each patch index
+		PreparedFaces own_faces;
+		const FaceBuffers& face_data;   // own_faces.faces unless shared
+		const Adjacency& face_graph;    // built on demand by build_face_graph
+		bool shared_faces;
+		PatchBuffers patch_data;
+		vector<int> labels;       // patch index of each face, -1 if none
+		int region_passes;        // update_regions calls since initialization
+
+		void build_face_graph();
+
+		double region_energy;
+		double centroid_displacement;
+		long long energy_evaluations;
+		int min_patch_size, max_patch_size;
+		vector<double> chunk_energy;   // per FACE_CHUNK, summed in order
+
+	private:
+		ILloydCvd(const ILloydCvd&);
+		ILloydCvd& operator=(const ILloydCvd&);
+};
+
+/* Per-thread accumulators of update_centroids, kept across iterations so
+   the steady-state loop does not allocate. Each thread owns one block of
+   STRIDE values per patch. */
+struct CentroidWorkspace
+{
+	enum { CX, CY, CZ, NX, NY, NZ, AREA, COUNT, BEST_DIST, BEST_FACE, STRIDE };
+
+	vector<double> acc;
+	int threads;
+	int patches;
+
+	CentroidWorkspace() : threads(0), patches(0) {}
+
+	void resize(int t, int p)
+	{
+		threads = t; patches = p;
+		if ( acc.size() < (size_t)t * p * STRIDE )
+			acc.resize( (size_t)t * p * STRIDE );
+	}
+
+	double* block(int t) { return &acc[ (size_t)t * patches * STRIDE ]; }
 };
 
 class LloydCvd : public ILloydCvd
 {
 
 	public:
-		LloydCvd( Mesh* mesh_ ) : ILloydCvd( mesh_ )
+		// find the closest patch with a kd-tree instead of scanning all
+		// patches with the simd kernel, once there are at least
+		// patch_index_min() of them
+		bool use_patch_index;
+		enum { PATCH_INDEX_BASE = 16, PATCH_INDEX_PER_LANE = 8 };
+		int patch_index_min() const
 		{
+			return PATCH_INDEX_BASE + PATCH_INDEX_PER_LANE * argmin_energy_lanes( argmin_energy );
 		}
 
-		void update_regions(Mesh* mesh);
+		// after incremental_after full passes, and at least one, test each
+		// face only against its patch and the patches next to it, and skip
+		// the faces where none of those moved more than
+		// incremental_tolerance (relative to bbox_diagonal for centers,
+		// absolute for normals)
+		bool incremental;
+		int incremental_after;
+		double incremental_tolerance;
+
+		LloydCvd( Mesh* mesh_ ) : ILloydCvd( mesh_ ), use_patch_index(true),
+			incremental(false), incremental_after(3), incremental_tolerance(0)
+		{
+		}
+		LloydCvd( CompactMesh* mesh_ ) : ILloydCvd( mesh_ ), use_patch_index(true),
+			incremental(false), incremental_after(3), incremental_tolerance(0)
+		{
+		}
+		LloydCvd( CompactMesh* mesh_, const PreparedFaces& shared ) : ILloydCvd( mesh_, shared ), use_patch_index(true),
+			incremental(false), incremental_after(3), incremental_tolerance(0)
+		{
+		}
+
+		int update_regions(Mesh* mesh);
 		void update_centroids(Mesh* mesh);
+
+	protected:
+		int update_regions_indexed(Mesh* mesh);
+		int update_regions_incremental(Mesh* mesh);
+		void build_patch_graph();
+
+		Adjacency patch_graph;        // patches sharing a boundary edge
+		vector<long long> patch_pairs;
+		vector<char> patch_moved;     // set by update_centroids
+
+		vector<double> patch_keys;
+		KdTree<3> index3;
+		KdTree<6> index6;
+
+		CentroidWorkspace workspace;
+};
+
+/* Regions grown over the surface: a multi-source Dijkstra on the face dual
+   graph, started from the center face of every patch, gives each face to
+   the patch whose center face is closest along the surface. The regions
+   are connected and the cost is O(F log F) whatever the number of patches.
+   Centroids are updated as in LloydCvd. The tentative distances live in
+   the Face objects, so this one needs a Mesh. */
+class GeodesicLloydCvd : public LloydCvd
+{
+	public:
+		GeodesicLloydCvd( Mesh* mesh_ ) : LloydCvd( mesh_ )
+		{
+		}
+
+		int update_regions(Mesh* mesh);
+
+	protected:
+		// (distance, face position), smallest first; a face whose distance
+		// has dropped since it was pushed leaves a stale entry behind
+		typedef pair<double, int> QueueEntry;
+		priority_queue< QueueEntry, vector<QueueEntry>, greater<QueueEntry> > queue;
+		vector<int> new_labels;
 };
 
 void ILloydCvd::initialize_centroids(Mesh* mesh, int k)
 {
-    srand ( 0 );
-	
 	for(FaceIter f = mesh->faces_begin(); f != mesh->faces_end(); f++)
 	{
 		(*f)->calculate_center();
@@ -57,43 +308,197 @@ void ILloydCvd::initialize_centroids(Mesh* mesh, int k)
 		(*v)->a.n.normalize();
 	}
 	
-	vector<Face*> faces( mesh->num_faces() );
-	FaceIter iter = mesh->faces_begin();
-	rep(a, faces.size() )
+	distance_scale = 2.0 / bbox_diagonal;
+
+#ifdef A48_INDEXED_CONTAINERS
+	// already a face list in index order unless faces were deleted
+	if ( mesh->fc_.slots() == mesh->num_faces() )
+		faces = mesh->fc_.elements();
+	else
+#endif
 	{
-		faces[a] = (*iter);
-		iter++;
+		faces.resize( mesh->num_faces() );
+		FaceIter iter = mesh->faces_begin();
+		rep(a, (int)faces.size() )
+		{
+			faces[a] = (*iter);
+			iter++;
+		}
 	}
-	
-	int i = 0;
-	while ( i < k )
+
+	own_faces.faces.build( faces );
+	own_faces.graph.offsets.clear();
+	seed_patches( k );
+
+	patches.clear();
+	rep(i, patch_data.size())
 	{
-		int j = rand()%mesh->num_faces();
-		Face& f = *( faces[j] );
-		
-		double d = (rand()%9999)/9999.;
-		if ( d < ( f.area() * f.density() ) )
+		Face& f = *( faces[ patch_data.center_face[i] ] );
+
+		Patch& p = *(mesh->put_patch());
+		p.set_center_face( &f );
+		p.center() = f.center();
+		p.normal() = f.normal();
+		f.set_patch( &p );
+
+		patches.push_back( &p );
+	}
+}
+
+/* No Face or Patch objects here: the face list stays empty and the face
+   graph comes straight from the half edges. */
+void ILloydCvd::initialize_centroids(CompactMesh* mesh, int k)
+{
+	distance_scale = 2.0 / bbox_diagonal;
+
+	faces.clear();
+	patches.clear();
+	if ( !shared_faces )
+		own_faces.build( *mesh );
+	seed_patches( k );
+}
+
+void ILloydCvd::initialize_centroids(CompactMesh* mesh, const PatchBuffers& centers)
+{
+	distance_scale = 2.0 / bbox_diagonal;
+
+	faces.clear();
+	patches.clear();
+	if ( !shared_faces )
+		own_faces.build( *mesh );
+
+	int nf = face_data.size();
+	labels.assign( nf, -1 );
+	region_passes = 0;
+
+	vector<double> points( 3 * (size_t)nf );
+	rep(f, nf)
+	{
+		points[3*f] = face_data.cx[f]; points[3*f + 1] = face_data.cy[f]; points[3*f + 2] = face_data.cz[f];
+	}
+	KdTree<3> tree;
+	tree.build( points );
+
+	patch_data.assign( centers );
+	rep(i, patch_data.size())
+	{
+		double q[3] = { patch_data.cx[i], patch_data.cy[i], patch_data.cz[i] };
+		double d2;
+		int j = tree.nearest( q, &d2 );
+		if ( labels[j] >= 0 )
+			j = nearest_free_face( q, j );
+		patch_data.center_face[i] = j;
+		labels[j] = i;
+	}
+}
+
+/* Two coarse centers can snap to the same fine face, and one region
+   would be lost. The faces around start are searched ring by ring over
+   the face graph instead, and the one closest to q in the first ring
+   that has a face without a center is taken; all faces are scanned when
+   the component of start has none left. */
+int ILloydCvd::nearest_free_face(const double* q, int start)
+{
+	int nf = face_data.size();
+	vector<char> seen( nf, 0 );
+	vector<int> ring( 1, start ), next;
+	seen[start] = 1;
+
+	int best = -1;
+	double best_d2 = INF;
+	while ( !ring.empty() && best < 0 )
+	{
+		next.clear();
+		rep(k, (int)ring.size())
+			for (const int* j = face_graph.begin(ring[k]); j != face_graph.end(ring[k]); j++)
+				if ( !seen[*j] )
+				{
+					seen[*j] = 1;
+					next.push_back( *j );
+				}
+		rep(k, (int)next.size())
 		{
-			Patch& p = *(mesh->put_patch());
-			p.set_center_face( &f );
-			p.center() = f.center();
-			p.normal() = f.normal();
-			f.set_patch( &p );
-			i++;
+			int f = next[k];
+			if ( labels[f] >= 0 )
+				continue;
+			double dx = face_data.cx[f] - q[0], dy = face_data.cy[f] - q[1], dz = face_data.cz[f] - q[2];
+			double d2 = dx*dx + dy*dy + dz*dz;
+			if ( d2 < best_d2 || ( d2 == best_d2 && f < best ) )
+			{
+				best_d2 = d2;
+				best = f;
+			}
 		}
+		ring.swap( next );
 	}
+
+	if ( best < 0 )
+		rep(f, nf)
+		{
+			if ( labels[f] >= 0 )
+				continue;
+			double dx = face_data.cx[f] - q[0], dy = face_data.cy[f] - q[1], dz = face_data.cz[f] - q[2];
+			double d2 = dx*dx + dy*dy + dz*dz;
+			if ( d2 < best_d2 )
+			{
+				best_d2 = d2;
+				best = f;
+			}
+		}
+	return best;
 }
 
-double ILloydCvd::get_energy(Patch& p, Face& f)
+/* Picks min(k, faces) distinct seed faces with the chosen seeding method
+   and makes each one the center of its patch. */
+void ILloydCvd::seed_patches(int k)
 {
-	double distance_scale = 2.0 / bbox_diagonal;
+	int nf = face_data.size();
+	labels.assign( nf, -1 );
+	region_passes = 0;
 
+	double wc = sqrt( alpha * distance_scale );
+	double wn = sqrt( 1 - alpha );
+	Rng r = rng;
+	vector<int> seeds;
+	switch ( seeding )
+	{
+	case SEED_KMEANSPP: seed_kmeanspp( face_data, k, wc, wn, r, pool, seeds ); break;
+	case SEED_KMEANS_PARALLEL: seed_kmeans_parallel( face_data, k, wc, wn, r, pool, seeds ); break;
+	default: seed_weighted( face_data, k, r, seeds ); break;
+	}
+
+	patch_data.resize( seeds.size() );
+	rep(i, (int)seeds.size())
+	{
+		int j = seeds[i];
+		patch_data.cx[i] = face_data.cx[j]; patch_data.cy[i] = face_data.cy[j]; patch_data.cz[i] = face_data.cz[j];
+		patch_data.nx[i] = face_data.nx[j]; patch_data.ny[i] = face_data.ny[j]; patch_data.nz[i] = face_data.nz[j];
+		patch_data.center_face[i] = j;
+		labels[j] = i;
+	}
+}
+
+double ILloydCvd::get_energy(Patch& p, Face& f)
+{
 	double e = alpha * distance_scale * (p.center() - f.center()).norm2()
 		+ (1 - alpha) * (p.normal() - f.normal()).norm2();
 
 	return e;
 }
 
+inline double ILloydCvd::get_energy(int p, int f)
+{
+	double dx = patch_data.cx[p] - face_data.cx[f];
+	double dy = patch_data.cy[p] - face_data.cy[f];
+	double dz = patch_data.cz[p] - face_data.cz[f];
+	double ex = patch_data.nx[p] - face_data.nx[f];
+	double ey = patch_data.ny[p] - face_data.ny[f];
+	double ez = patch_data.nz[p] - face_data.nz[f];
+
+	return alpha * distance_scale * (dx*dx + dy*dy + dz*dz)
+		+ (1 - alpha) * (ex*ex + ey*ey + ez*ez);
+}
+
 Face* ILloydCvd::project_to_region(vector<Face*>& faces, Vector3 c )
 {
 	int best_face = 0;
@@ -101,7 +506,7 @@ Face* ILloydCvd::project_to_region(vector<Face*>& faces, Vector3 c )
 
 	if ( faces.size() == 0 )
 	{
-		cout << "Oh my god! They killed Kenny! You bastards!" << endl;
+		CVD_LOG( "project_to_region: empty region" );
 		return NULL;
 	}
 
@@ -130,91 +535,635 @@ void ILloydCvd::print_centroids(Mesh* mesh)
 void ILloydCvd::lloyd_euclidean_cvd(Mesh* mesh, int regions, int iterations )
 {
 	initialize_centroids(mesh, regions);
+	run_iterations(mesh, iterations);
+
+	write_back(mesh);
+
+	for (auto f : mesh->fc_)
+	{
+		f->p_->add_face_patch(f);
+	}
+}
+
+void ILloydCvd::lloyd_euclidean_cvd(CompactMesh* mesh, int regions, int iterations )
+{
+	initialize_centroids(mesh, regions);
+	run_iterations(NULL, iterations);
+}
+
+/* Multilevel Lloyd: mesh is simplified by quadric edge collapse into
+   levels of about 4 times fewer faces each, down to coarsest_faces (0
+   for max(2000, 50 regions)). The seeds are picked and iterations run
+   on the coarsest level, where each one is cheap; the centers are then
+   carried to the next finer level, ending with mesh itself, and refined
+   there with refine_iterations (at least one, which labels the faces).
+   The stopping criteria apply on every level. history covers the levels
+   in turn, and the observer sees each level as a run of its own. */
+void ILloydCvd::lloyd_multilevel_cvd(CompactMesh* mesh, int regions, int iterations, int refine_iterations,
+	int coarsest_faces )
+{
+	if ( shared_faces )
+	{
+		lloyd_euclidean_cvd( mesh, regions, iterations );
+		return;
+	}
+	if ( coarsest_faces <= 0 )
+		coarsest_faces = max( 2000, 50 * regions );
+
+	int nv = mesh->num_verts();
+	vector<double> xyz( 3 * (size_t)nv );
+	rep(v, nv)
+	{
+		xyz[3*v] = mesh->positions[v].x; xyz[3*v + 1] = mesh->positions[v].y; xyz[3*v + 2] = mesh->positions[v].z;
+	}
+	vector<MeshLevel> levels;
+	build_mesh_hierarchy( xyz.data(), nv, mesh->tris.data(), mesh->num_faces(), coarsest_faces, 4, levels );
+	if ( levels.empty() )
+	{
+		lloyd_euclidean_cvd( mesh, regions, iterations );
+		return;
+	}
+
+	vector<CvdIterationStats> all;
+	PatchBuffers centers;
+	rep(l, (int)levels.size() + 1)
+	{
+		CompactMesh level_mesh;
+		CompactMesh* m = mesh;
+		if ( l < (int)levels.size() )
+		{
+			MeshLevel& level = levels[l];
+			level_mesh.build( level.positions.data(), level.num_verts(), level.tris.data(), level.num_faces(), pool );
+			m = &level_mesh;
+		}
+
+		if ( l == 0 )
+			initialize_centroids( m, regions );
+		else
+			initialize_centroids( m, centers );
+		CVD_LOG( "level " << l << ": " << m->num_faces() << " faces" );
+
+		run_iterations( NULL, l == 0 ? iterations : max( refine_iterations, 1 ) );
+		all.insert( all.end(), history.begin(), history.end() );
+		centers.assign( patch_data );
+	}
+	history.swap( all );
+}
+
+void ILloydCvd::run_iterations(Mesh* mesh, int iterations)
+{
+	history.clear();
+	history.reserve( iterations );
+	stop_reason = STOP_ITERATIONS;
 	
+	typedef std::chrono::steady_clock clock;
 	for (int i = 0; i < iterations; i++)
 	{
-		this->update_regions(mesh);
+		CvdIterationStats s;
+		clock::time_point t0 = clock::now();
+		s.reassigned = this->update_regions(mesh);
+		clock::time_point t1 = clock::now();
+		s.energy = region_energy;
+		s.energy_evaluations = energy_evaluations;
 		this->update_centroids(mesh);
-		//print_centroids(mesh);
+		clock::time_point t2 = clock::now();
+		s.max_displacement = centroid_displacement / bbox_diagonal;
+		s.regions_ns = std::chrono::duration_cast<std::chrono::nanoseconds>( t1 - t0 ).count();
+		s.centroids_ns = std::chrono::duration_cast<std::chrono::nanoseconds>( t2 - t1 ).count();
+		s.min_patch_size = min_patch_size;
+		s.max_patch_size = max_patch_size;
+
+		CVD_LOG( "iteration " << i << ": energy " << s.energy << ", " << s.reassigned << " reassigned, patches of "
+			<< s.min_patch_size << " to " << s.max_patch_size << " faces" );
+
+		bool stop = should_stop(s);
+		history.push_back(s);
+		if ( observer )
+			observer->on_iteration( *this, i, s );
+		if ( stop ) break;
 	}
+	if ( observer )
+		observer->on_finish( *this, stop_reason );
+}
 
-	for (auto f : mesh->fc_)
+/* Checks the stopping criteria against the previous iteration and sets
+   stop_reason when one of them is met. */
+bool ILloydCvd::should_stop(const CvdIterationStats& s)
+{
+	if ( s.reassigned == 0 )
+		stop_reason = STOP_CONVERGED;
+	else if ( max_reassigned_fraction > 0 && s.reassigned <= max_reassigned_fraction * face_data.size() )
+		stop_reason = STOP_REASSIGNED;
+	else if ( min_energy_decrease > 0 && !history.empty()
+		&& history.back().energy - s.energy <= min_energy_decrease * history.back().energy )
+		stop_reason = STOP_ENERGY;
+	else if ( max_displacement > 0 && s.max_displacement <= max_displacement )
+		stop_reason = STOP_DISPLACEMENT;
+	else
+		return false;
+	return true;
+}
+
+const char* ILloydCvd::stop_reason_name(CvdStopReason r)
+{
+	switch (r)
 	{
-		f->p_->add_face_patch(f);
+	case STOP_CONVERGED: return "converged";
+	case STOP_REASSIGNED: return "reassigned faces";
+	case STOP_ENERGY: return "energy decrease";
+	case STOP_DISPLACEMENT: return "center displacement";
+	default: return "iterations";
 	}
 }
 
-void LloydCvd::update_centroids(Mesh * mesh)
+void ILloydCvd::build_face_graph()
 {
-	if (!mesh) return;
+	if ( face_graph.size() != face_data.size() )
+		build_face_adjacency( faces, own_faces.graph );
+}
 
-	cout << "LloydCvd::update_centroids" << endl;
-	
-	vector<Vector3> centers( mesh->num_patches(), Vector3(0,0,0) );
-	vector<Vector3> normals( mesh->num_patches(), Vector3(0,0,0) );
-	vector<double> areas( mesh->num_patches(), 0 );
-	vector< vector<Face*> > patch_faces( mesh->num_patches() );
-	
-	for(FaceIter f = mesh->faces_begin(); f != mesh->faces_end(); f++)
+double ILloydCvd::labels_energy()
+{
+	chunk_energy.resize( (face_data.size() + FACE_CHUNK - 1) / FACE_CHUNK );
+	pool->parallel_for( face_data.size(), FACE_CHUNK, [&](int begin, int end, int)
 	{
-		auto ff = (*f);
-		if (!ff) 
-			continue;
+		double energy = 0;
+		for (int i = begin; i < end; i++)
+			if ( labels[i] >= 0 )
+				energy += face_data.w[i] * get_energy( labels[i], i );
+		chunk_energy[ begin / FACE_CHUNK ] = energy;
+	});
+	return sum_chunk_energy();
+}
 
-		auto p = (ff->patch());
-		if (!p) 
-			continue;
+double ILloydCvd::sum_chunk_energy()
+{
+	double e = 0;
+	urep(i, chunk_energy.size())
+		e += chunk_energy[i];
+	return e;
+}
 
-		int pId = p->get_index();
-		centers[pId] += ff->center() * (ff->area() * ff->density());
-		normals[pId] += ff->normal() * (ff->area() * ff->density());
-		areas[pId] += ff->area() * ff->density();
-		
-		patch_faces[ pId ].push_back( *f );
-	}	
-	
-	for(PatchIter p = mesh->patches_begin(); p != mesh->patches_end(); p++)
+void ILloydCvd::write_back(Mesh* )
+{
+	rep(i, (int)faces.size())
+		faces[i]->set_patch( labels[i] >= 0 ? patches[ labels[i] ] : NULL );
+
+	rep(k, (int)patches.size())
 	{
-		Patch& pp = *(*p);
-		int pId = pp.get_index();
-		Vector3 c = centers[ pId ];
-		c *= 1. / areas[pId];
-		Face* fc = project_to_region( patch_faces[pId], c );
-		if ( fc != NULL )
+		Patch& pp = *patches[k];
+		Face* fc = faces[ patch_data.center_face[k] ];
+		pp.set_center_face( fc );
+		pp.center() = fc->center();
+		pp.normal() = Vector3( patch_data.nx[k], patch_data.ny[k], patch_data.nz[k] );
+	}
+}
+
+/* Two parallel passes over the faces, each thread on a fixed slice: the
+   first sums weighted centers, normals and areas per patch, the second
+   finds the face of each patch closest to the new centroid. Per-thread
+   results are merged into the first block, ties going to the earlier face
+   so the outcome does not depend on the thread count. */
+void LloydCvd::update_centroids(Mesh * )
+{
+	const int S = CentroidWorkspace::STRIDE;
+	int np = patch_data.size();
+	int nf = face_data.size();
+	int nt = pool->size();
+	workspace.resize( nt, np );
+
+	pool->parallel_for( nt, 1, [&](int t, int, int)
+	{
+		double* acc = workspace.block(t);
+		std::fill( acc, acc + (size_t)np * S, 0.0 );
+
+		for (int i = nf * (long long)t / nt; i < nf * (long long)(t+1) / nt; i++)
+		{
+			int p = labels[i];
+			if (p < 0)
+				continue;
+
+			double w = face_data.w[i];
+			double* a = acc + p * S;
+			a[CentroidWorkspace::CX] += face_data.cx[i] * w;
+			a[CentroidWorkspace::CY] += face_data.cy[i] * w;
+			a[CentroidWorkspace::CZ] += face_data.cz[i] * w;
+			a[CentroidWorkspace::NX] += face_data.nx[i] * w;
+			a[CentroidWorkspace::NY] += face_data.ny[i] * w;
+			a[CentroidWorkspace::NZ] += face_data.nz[i] * w;
+			a[CentroidWorkspace::AREA] += w;
+			a[CentroidWorkspace::COUNT] += 1;
+		}
+	});
+
+	double* total = workspace.block(0);
+	pool->parallel_for( np, FACE_CHUNK, [&](int begin, int end, int)
+	{
+		for (int t = 1; t < nt; t++)
+		{
+			double* acc = workspace.block(t);
+			for (int k = begin * S; k < end * S; k++)
+				total[k] += acc[k];
+		}
+		for (int k = begin; k < end; k++)
 		{
-			pp.center() = fc->center();
-			pp.set_center_face( fc );
+			double* a = total + k * S;
+			double inv = 1. / a[CentroidWorkspace::AREA];
+			a[CentroidWorkspace::CX] *= inv;
+			a[CentroidWorkspace::CY] *= inv;
+			a[CentroidWorkspace::CZ] *= inv;
+		}
+	});
+
+	pool->parallel_for( nt, 1, [&](int t, int, int)
+	{
+		double* acc = workspace.block(t);
+		for (int k = 0; k < np; k++)
+		{
+			acc[k*S + CentroidWorkspace::BEST_DIST] = INF;
+			acc[k*S + CentroidWorkspace::BEST_FACE] = -1;
+		}
 
-			normals[ pId ].normalize();
-			pp.normal() = normals[ pId ];
+		for (int i = nf * (long long)t / nt; i < nf * (long long)(t+1) / nt; i++)
+		{
+			int p = labels[i];
+			if (p < 0)
+				continue;
+
+			double* a = acc + p * S;
+			double* c = total + p * S;
+			double dx = face_data.cx[i] - c[CentroidWorkspace::CX];
+			double dy = face_data.cy[i] - c[CentroidWorkspace::CY];
+			double dz = face_data.cz[i] - c[CentroidWorkspace::CZ];
+			double dist = dx*dx + dy*dy + dz*dz;
+			if ( dist < a[CentroidWorkspace::BEST_DIST] )
+			{
+				a[CentroidWorkspace::BEST_DIST] = dist;
+				a[CentroidWorkspace::BEST_FACE] = i;
+			}
 		}
+	});
+
+	centroid_displacement = 0;
+	min_patch_size = np ? nf : 0;
+	max_patch_size = 0;
+	patch_moved.assign( np, 0 );
+	double tol_c = incremental_tolerance * bbox_diagonal;
+	double tol_n = ( alpha < 1 ) ? incremental_tolerance : INF;
+
+	rep(pId, np)
+	{
+		double* a = total + pId * S;
+
+		for (int t = 1; t < nt; t++)
+		{
+			double* b = workspace.block(t) + pId * S;
+			if ( b[CentroidWorkspace::BEST_DIST] < a[CentroidWorkspace::BEST_DIST] )
+			{
+				a[CentroidWorkspace::BEST_DIST] = b[CentroidWorkspace::BEST_DIST];
+				a[CentroidWorkspace::BEST_FACE] = b[CentroidWorkspace::BEST_FACE];
+			}
+		}
+
+		int best = (int)a[CentroidWorkspace::BEST_FACE];
+		if ( best >= 0 )
+		{
+			double dx = face_data.cx[best] - patch_data.cx[pId];
+			double dy = face_data.cy[best] - patch_data.cy[pId];
+			double dz = face_data.cz[best] - patch_data.cz[pId];
+			double dc = sqrt( dx*dx + dy*dy + dz*dz );
+			centroid_displacement = max( centroid_displacement, dc );
 
-		cout << "patch " << pId << " size = " << patch_faces[pId].size() << endl;
+			patch_data.cx[pId] = face_data.cx[best];
+			patch_data.cy[pId] = face_data.cy[best];
+			patch_data.cz[pId] = face_data.cz[best];
+			patch_data.center_face[pId] = best;
+
+			Vector3 n( a[CentroidWorkspace::NX], a[CentroidWorkspace::NY], a[CentroidWorkspace::NZ] );
+			n.normalize();
+			Vector3 dn = n - Vector3( patch_data.nx[pId], patch_data.ny[pId], patch_data.nz[pId] );
+			patch_moved[pId] = ( dc > tol_c || dn.norm() > tol_n );
+			patch_data.nx[pId] = n.x; patch_data.ny[pId] = n.y; patch_data.nz[pId] = n.z;
+		}
+		else
+		{
+			CVD_LOG( "update_centroids: patch " << pId << " has no face left" );
+		}
+
+		int size = (int)a[CentroidWorkspace::COUNT];
+		min_patch_size = min( min_patch_size, size );
+		max_patch_size = max( max_patch_size, size );
 	}
 }
 
-void LloydCvd::update_regions(Mesh* mesh)
+/* Three ways to the closest patch. The incremental pass, once enabled
+   and started, tests each face against its own patch and the next ones.
+   Otherwise the simd kernel scans every patch, which costs patches /
+   lanes energies per face, and the kd-tree walks about its depth plus a
+   few leaves. Measured on meshes of 10^5 faces the tree only wins above
+   some 16 + 8 * lanes patches, 24 for the scalar kernel to 80 with
+   avx512, and patch_index_min() puts the switch there. */
+int LloydCvd::update_regions(Mesh* mesh)
 {
-	cout << "LloydCvd::update_regions" << endl;
-	
-	for(FaceIter f = mesh->faces_begin(); f != mesh->faces_end(); f++)
+	int np = patch_data.size();
+	region_passes++;
+
+	// an incremental pass starts from the labels of a full pass and the
+	// patch_moved flags of the centroid update after it
+	if ( incremental && region_passes > max( incremental_after, 1 ) && (int)patch_moved.size() == np )
+		return update_regions_incremental(mesh);
+
+	if ( use_patch_index && np >= patch_index_min() )
+		return update_regions_indexed(mesh);
+
+	std::atomic<int> reassigned(0);
+
+	const double* p[6] = { patch_data.cx.data(), patch_data.cy.data(), patch_data.cz.data(),
+		patch_data.nx.data(), patch_data.ny.data(), patch_data.nz.data() };
+	double wc = alpha * distance_scale;
+	double wn = 1 - alpha;
+	chunk_energy.resize( (face_data.size() + FACE_CHUNK - 1) / FACE_CHUNK );
+
+	pool->parallel_for( face_data.size(), FACE_CHUNK, [&](int begin, int end, int)
 	{
-		Face&ff = *(*f);
-		double min_energy = INF;
-		
-		for(PatchIter p = mesh->patches_begin(); p != mesh->patches_end(); p++)
+		int changed = 0;
+		double energy = 0;
+		for (int i = begin; i < end; i++)
 		{
-			Patch& pp = *(*p);
-		
-			double energy = get_energy(pp,ff);
-			if ( energy < min_energy )
+			double f[6] = { face_data.cx[i], face_data.cy[i], face_data.cz[i],
+				face_data.nx[i], face_data.ny[i], face_data.nz[i] };
+
+			double e;
+			int best = argmin_energy( p, np, f, wc, wn, &e );
+			if ( best < 0 )
+				continue;
+			energy += face_data.w[i] * e;
+			if ( best != labels[i] )
 			{
-				min_energy = energy;
-				ff.set_patch( *p );
+				labels[i] = best;
+				changed++;
 			}
 		}
+		chunk_energy[ begin / FACE_CHUNK ] = energy;
+		reassigned += changed;
+	});
+
+	region_energy = sum_chunk_energy();
+	energy_evaluations = (long long)face_data.size() * np;
+	return reassigned;
+}
+
+/* The energy is a squared distance once the center is scaled by
+   sqrt(alpha * distance_scale) and the normal by sqrt(1 - alpha), so the
+   patch of minimum energy is the nearest neighbour in that space: 3D on the
+   centers when alpha == 1, 6D on centers and normals otherwise. */
+int LloydCvd::update_regions_indexed(Mesh* )
+{
+	double wc = sqrt( alpha * distance_scale );
+	double wn = sqrt( 1 - alpha );
+	bool euclidean = ( alpha == 1.0 );
+	int dim = euclidean ? 3 : 6;
+
+	int np = patch_data.size();
+	patch_keys.resize( np * dim );
+
+	rep(i, np)
+	{
+		double* k = &patch_keys[i*dim];
+		k[0] = wc * patch_data.cx[i]; k[1] = wc * patch_data.cy[i]; k[2] = wc * patch_data.cz[i];
+		if ( !euclidean )
+		{
+			k[3] = wn * patch_data.nx[i]; k[4] = wn * patch_data.ny[i]; k[5] = wn * patch_data.nz[i];
+		}
 	}
+
+	if ( euclidean )
+		index3.build( patch_keys );
+	else
+		index6.build( patch_keys );
+
+	std::atomic<int> reassigned(0);
+	std::atomic<long long> evaluations(0);
+	chunk_energy.resize( (face_data.size() + FACE_CHUNK - 1) / FACE_CHUNK );
+
+	pool->parallel_for( face_data.size(), FACE_CHUNK, [&](int begin, int end, int)
+	{
+		int changed = 0;
+		double energy = 0;
+		long long evals = 0;
+		for (int i = begin; i < end; i++)
+		{
+			double q[6] = { wc * face_data.cx[i], wc * face_data.cy[i], wc * face_data.cz[i],
+				wn * face_data.nx[i], wn * face_data.ny[i], wn * face_data.nz[i] };
+
+			double e;
+			int best = euclidean ? index3.nearest( q, &e, &evals ) : index6.nearest( q, &e, &evals );
+			if ( best < 0 )
+				continue;
+			energy += face_data.w[i] * e;
+			if ( best != labels[i] )
+			{
+				labels[i] = best;
+				changed++;
+			}
+		}
+		chunk_energy[ begin / FACE_CHUNK ] = energy;
+		reassigned += changed;
+		evaluations += evals;
+	});
+
+	region_energy = sum_chunk_energy();
+	energy_evaluations = evaluations;
+	return reassigned;
 }
 
+/* Patch adjacency from the face pairs across a patch boundary, that is the
+   edges where Edge::is_patch_bdry() holds for the current labels. */
+void LloydCvd::build_patch_graph()
+{
+	build_face_graph();
+
+	int np = patch_data.size();
+	patch_pairs.clear();
+	rep(i, face_graph.size())
+	{
+		int a = labels[i];
+		for (const int* j = face_graph.begin(i); j != face_graph.end(i); j++)
+		{
+			int b = labels[*j];
+			if ( a >= 0 && b >= 0 && a != b )
+				patch_pairs.push_back( (long long)a * np + b );
+		}
+	}
+	std::sort( patch_pairs.begin(), patch_pairs.end() );
+	patch_pairs.erase( std::unique( patch_pairs.begin(), patch_pairs.end() ), patch_pairs.end() );
+
+	patch_graph.offsets.assign( np + 1, 0 );
+	patch_graph.adj.resize( patch_pairs.size() );
+	urep(k, patch_pairs.size())
+	{
+		patch_graph.offsets[ patch_pairs[k] / np + 1 ]++;
+		patch_graph.adj[k] = (int)( patch_pairs[k] % np );
+	}
+	rep(p, np)
+		patch_graph.offsets[p+1] += patch_graph.offsets[p];
+}
+
+/* A face can only move to its own patch or to a neighbouring one, so only
+   those are tested. Faces whose candidate patches all stayed put keep
+   their region without any energy evaluation beyond their own. */
+int LloydCvd::update_regions_incremental(Mesh* )
+{
+	build_patch_graph();
+
+	std::atomic<int> reassigned(0);
+	std::atomic<long long> evaluations(0);
+	chunk_energy.resize( (face_data.size() + FACE_CHUNK - 1) / FACE_CHUNK );
+
+	pool->parallel_for( face_data.size(), FACE_CHUNK, [&](int begin, int end, int)
+	{
+		int changed = 0;
+		double energy = 0;
+		long long evals = 0;
+		for (int i = begin; i < end; i++)
+		{
+			int l = labels[i];
+			if ( l < 0 )
+				continue;
+
+			const int* nb = patch_graph.begin(l);
+			const int* ne = patch_graph.end(l);
+
+			bool moved = patch_moved[l] != 0;
+			for (const int* p = nb; p != ne && !moved; p++)
+				moved = patch_moved[*p] != 0;
+
+			int best = l;
+			double min_energy = get_energy(l, i);
+			evals++;
+			if ( moved )
+			{
+				evals += ne - nb;
+				for (const int* p = nb; p != ne; p++)
+				{
+					double e = get_energy(*p, i);
+					if ( e < min_energy )
+					{
+						min_energy = e;
+						best = *p;
+					}
+				}
+			}
+
+			energy += face_data.w[i] * min_energy;
+			if ( best != l )
+			{
+				labels[i] = best;
+				changed++;
+			}
+		}
+		chunk_energy[ begin / FACE_CHUNK ] = energy;
+		reassigned += changed;
+		evaluations += evals;
+	});
+
+	region_energy = sum_chunk_energy();
+	energy_evaluations = evaluations;
+	return reassigned;
+}
+
+int GeodesicLloydCvd::update_regions(Mesh* )
+{
+	region_passes++;
+	build_face_graph();
+
+	int nf = face_data.size();
+	int np = patch_data.size();
+
+	new_labels.assign( nf, -1 );
+	energy_evaluations = 0;
+	rep(i, nf)
+	{
+		faces[i]->distance() = INF;
+		faces[i]->set_parent( NULL );
+	}
+
+	rep(p, np)
+	{
+		int s = patch_data.center_face[p];
+		Face* f = faces[s];
+		f->distance() = 0;
+		new_labels[s] = p;
+		queue.push( QueueEntry( 0.0, s ) );
+	}
+
+	// keyed on the double distances themselves, so faces are settled in
+	// exactly increasing distance, ties by position
+	while ( !queue.empty() )
+	{
+		QueueEntry top = queue.top();
+		queue.pop();
+		int i = top.second;
+		Face* f = faces[i];
+		if ( top.first > f->distance() )
+			continue;
+
+		for (const int* j = face_graph.begin(i); j != face_graph.end(i); j++)
+		{
+			double dx = face_data.cx[*j] - face_data.cx[i];
+			double dy = face_data.cy[*j] - face_data.cy[i];
+			double dz = face_data.cz[*j] - face_data.cz[i];
+			double d = f->distance() + sqrt( dx*dx + dy*dy + dz*dz );
+			energy_evaluations++;
+
+			Face* g = faces[*j];
+			if ( d < g->distance() )
+			{
+				g->distance() = d;
+				g->set_parent( f );
+				new_labels[*j] = new_labels[i];
+				queue.push( QueueEntry( d, *j ) );
+			}
+		}
+	}
+
+	// faces on components without a center face fall back to the closest patch
+	const double* p[6] = { patch_data.cx.data(), patch_data.cy.data(), patch_data.cz.data(),
+		patch_data.nx.data(), patch_data.ny.data(), patch_data.nz.data() };
+
+	int reassigned = 0;
+	region_energy = 0;
+	rep(i, nf)
+	{
+		double e;
+		if ( new_labels[i] >= 0 )
+		{
+			// get_energy with the geodesic distance to the center face in
+			// place of the straight one, so alpha weighs it the same way
+			int l = new_labels[i];
+			double d = faces[i]->distance();
+			double ex = patch_data.nx[l] - face_data.nx[i];
+			double ey = patch_data.ny[l] - face_data.ny[i];
+			double ez = patch_data.nz[l] - face_data.nz[i];
+			e = alpha * distance_scale * d * d + (1 - alpha) * (ex*ex + ey*ey + ez*ez);
+		}
+		else
+		{
+			double f[6] = { face_data.cx[i], face_data.cy[i], face_data.cz[i],
+				face_data.nx[i], face_data.ny[i], face_data.nz[i] };
+			new_labels[i] = argmin_energy( p, np, f, alpha * distance_scale, 1 - alpha, &e );
+			energy_evaluations += np;
+		}
+
+		region_energy += face_data.w[i] * e;
+		if ( new_labels[i] != labels[i] )
+		{
+			labels[i] = new_labels[i];
+			reassigned++;
+		}
+	}
+
+	return reassigned;
+}
 
 #endif
@@ -0,0 +1,112 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace A48 {
+
+	/* Read-only view of a whole file mapped in memory. The data is not
+	   null-terminated; an empty file maps to a null pointer of size 0. */
+	class MappedFile {
+	public:
+		MappedFile() : data_(0), size_(0), opened_empty_(false) {}
+		explicit MappedFile(const std::string& filename) : data_(0), size_(0), opened_empty_(false) { open(filename); }
+		~MappedFile() { close(); }
+
+		bool open(const std::string& filename);
+		void close();
+
+		bool is_open() const { return data_ != 0 || opened_empty_; }
+		const char* data() const { return data_; }
+		size_t size() const { return size_; }
+
+	private:
+		MappedFile(const MappedFile&);
+		MappedFile& operator=(const MappedFile&);
+
+		const char* data_;
+		size_t size_;
+		bool opened_empty_;
+	};
+
+
+	/* implementation */
+
+#ifdef _WIN32
+
+	inline bool MappedFile::open(const std::string& filename)
+	{
+		close();
+		HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+			OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (file == INVALID_HANDLE_VALUE) return false;
+
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(file, &size)) { CloseHandle(file); return false; }
+		size_ = (size_t)size.QuadPart;
+		if (size_ == 0) { CloseHandle(file); opened_empty_ = true; return true; }
+
+		HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		CloseHandle(file);
+		if (!mapping) { size_ = 0; return false; }
+		data_ = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		CloseHandle(mapping);
+		if (!data_) size_ = 0;
+		return data_ != 0;
+	}
+
+	inline void MappedFile::close()
+	{
+		if (data_) UnmapViewOfFile(data_);
+		data_ = 0;
+		size_ = 0;
+		opened_empty_ = false;
+	}
+
+#else
+
+	inline bool MappedFile::open(const std::string& filename)
+	{
+		close();
+		int fd = ::open(filename.c_str(), O_RDONLY);
+		if (fd < 0) return false;
+
+		struct stat st;
+		if (fstat(fd, &st) != 0) { ::close(fd); return false; }
+		size_ = (size_t)st.st_size;
+		if (size_ == 0) { ::close(fd); opened_empty_ = true; return true; }
+
+		void* p = mmap(0, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if (p == MAP_FAILED) { size_ = 0; return false; }
+		madvise(p, size_, MADV_SEQUENTIAL);
+		data_ = (const char*)p;
+		return true;
+	}
+
+	inline void MappedFile::close()
+	{
+		if (data_) munmap((void*)data_, size_);
+		data_ = 0;
+		size_ = 0;
+		opened_empty_ = false;
+	}
+
+#endif
+
+}
+
+#endif
@@ -5,6 +5,18 @@
 
 namespace A48 {
 
+/* Bytes taken by one vertex, face and edge, container entry and optional
+   attributes included, for a given set of MeshAttribute flags. */
+struct MeshMemoryReport {
+    unsigned attributes;
+    size_t vertex_bytes;
+    size_t face_bytes;
+    size_t edge_bytes;
+    size_t total;   // whole mesh, 0 for a layout without a mesh
+
+    void print(std::ostream& out) const;
+};
+
 class Mesh {
 public:
     PatchContainer  pc_;   // patches
@@ -15,6 +27,9 @@ public:
     Mesh();
     ~Mesh();
 
+    // room for that many more elements in contiguous slabs
+    void reserve(int verts, int edges, int faces);
+
     void delete_patches();
 
     VertexIter verts_begin(){ return vc_.begin(); }
@@ -33,22 +48,61 @@ public:
     PatchIter patches_end() { return pc_.end(); }
     int num_patches() { return pc_.size(); }
 
+    // Optional data of the given MeshAttribute flags, allocated for every
+    // element present and added later. Accessors below are only valid for
+    // attributes that were requested.
+    void request_attributes(unsigned attributes);
+    void release_attributes(unsigned attributes);
+    bool has_attributes(unsigned attributes) const { return (attributes_ & attributes) == attributes; }
+
+    Vector3& texcoord(Vertex* v) { return texcoords_[v->index]; }
+    Vector3& texcoord(Face* f, int k) { return face_texcoords_[f->index].t[k]; }
+    Vector3& position2(Vertex* v) { return positions2_[v->index]; }
+    Vector3& normal2(Vertex* v) { return normals2_[v->index]; }
+    Curvature& curvature(Vertex* v) { return curvatures_[v->index]; }
+
+    MeshMemoryReport memory_report();
+    static MeshMemoryReport memory_layout(unsigned attributes);
+    // one line per combination of attributes
+    static void print_memory_layouts(std::ostream& out);
+
+#ifdef A48_INDEXED_CONTAINERS
+    // element of a given index, NULL if it was deleted
+    Vertex* vertex(int i) { return vc_.at(i); }
+    Edge* edge(int i) { return ec_.at(i); }
+    Face* face(int i) { return fc_.at(i); }
+    Patch* patch(int i) { return pc_.at(i); }
+#endif
+
 private:
     Vertex *add_vertex();
     bool add_vertex(Vertex *v)
-    { std::pair<VertexIter, bool> r = vc_.insert(v); return r.second; }
-    void del_vertex(Vertex* v) { vc_.erase(v); delete(v); }
+    {
+        std::pair<VertexIter, bool> r = vc_.insert(v);
+        if (attributes_) fit_attributes(v->index + 1, 0);
+        return r.second;
+    }
+    void del_vertex(Vertex* v) {
+        vc_.erase(v);
+        if (varena_.owns(v)) { varena_.destroy(v); return; }
+        foreign_verts_.erase(std::find(foreign_verts_.begin(), foreign_verts_.end(), v));
+        delete(v);
+    }
 
     Hedge *add_edge(Vertex *v0, Vertex *v1);
     bool add_edge(Edge *e)
     { std::pair<EdgeIter, bool> r = ec_.insert(e);  return r.second;}
-    void del_edge(Edge* e) { ec_.erase(e); delete(e); }
+    void del_edge(Edge* e) { ec_.erase(e); earena_.destroy(e); }
 
     Face* add_face(Hedge* e0, Hedge* e1, Hedge* e2);
     Face* add_face(Hedge *e0, Hedge *e1, Hedge *e2, float v0, float v1, float v2, float v3, float v4, float v5);
 
     bool add_face(Face* f)
-    { std::pair<FaceIter, bool> r = fc_.insert(f); return r.second;}
+    {
+        std::pair<FaceIter, bool> r = fc_.insert(f);
+        if (attributes_ & ATTR_TEXCOORDS) fit_attributes(0, f->index + 1);
+        return r.second;
+    }
     void del_face(Face* f) {
         Patch *p = f->patch();
 
@@ -58,7 +112,7 @@ private:
         }
 
         fc_.erase(f);
-        delete(f);
+        farena_.destroy(f);
     }
 
     Patch* add_patch();
@@ -76,13 +130,46 @@ private:
             }
         }
         pc_.erase(p);
-        delete(p);
+        parena_.destroy(p);
     }
 
     Hedge* get_hedge(int i0, int i1, Vertex* verts[], HedgeMap* edges);
 
+    // index given to the next element added to a container
+    template<class T>
+    static int next_index(const std::set<T*>& c) { return (int)c.size(); }
+#ifdef A48_INDEXED_CONTAINERS
+    template<class T>
+    static int next_index(const IndexedContainer<T>& c) { return c.slots(); }
+#endif
+
+    template<class C, class T>
+    static void release(C& c, ObjectArena<T>& arena);
+
+    // grows the attribute arrays to hold that many vertices and faces
+    void fit_attributes(int verts, int faces);
+    int vertex_slots();
+    int face_slots();
+
+    // elements live in slabs owned by the mesh, except vertices handed
+    // over by put_vertex, which are deleted one by one
+    ObjectArena<Vertex> varena_;
+    ObjectArena<Edge>   earena_;
+    ObjectArena<Face>   farena_;
+    ObjectArena<Patch>  parena_;
+    std::vector<Vertex*> foreign_verts_;
+
+    unsigned attributes_;
+    std::vector<Vector3> texcoords_;
+    std::vector<FaceTexCoords> face_texcoords_;
+    std::vector<Vector3> positions2_;
+    std::vector<Vector3> normals2_;
+    std::vector<Curvature> curvatures_;
+
 public:
-    void put_vertex(Vertex *v) { add_vertex(v); }
+    // with A48_INDEXED_CONTAINERS the vertex index must be set beforehand
+    void put_vertex(Vertex *v) { if (add_vertex(v)) foreign_verts_.push_back(v); }
+    Vertex* new_vertex() { return add_vertex(); }
     void put_face(int i0, int i1, int i2, Vertex* verts[], HedgeMap* edges);
     void put_face(int i0, int i1, int i2, float v0, float v1, float v2, float v3, float v4, float v5, Vertex* verts[], HedgeMap* hedges);
     void put_face(int i0, int i1, int i2, Vertex* verts[], HedgeMap* edges, FaceMap* faces);
@@ -90,6 +177,12 @@ public:
 
 	void link_mesh();
 
+    // Builds every face, edge and star pointer from a flat triangle index
+    // buffer (3 indices per face into verts[0..nverts)) in one go, instead
+    // of put_face/link_mesh. False, with nothing added, when an index is
+    // out of range.
+    bool build(Vertex* verts[], int nverts, const int* tris, int nfaces, ThreadPool* pool = NULL);
+
     Patch* put_patch();
     void put_patch(int *i, int size, FaceMap* faces, int camera_index, float *box);
 
@@ -100,37 +193,152 @@ public:
 
 
 /* implementation */
-Mesh::Mesh()
+Mesh::Mesh() : attributes_(0)
 {}
 
 Mesh::~Mesh()
 {
-    for (VertexIter p = vc_.begin(); p != vc_.end(); p++)
-        delete *p;
-    vc_.clear();
-    for (EdgeIter e = ec_.begin(); e != ec_.end(); e++)
-        delete *e;
-    ec_.clear();
+    for (size_t i = 0; i < foreign_verts_.size(); i++)
+        delete foreign_verts_[i];
+    release(vc_, varena_);
+    release(ec_, earena_);
+    release(fc_, farena_);
+    release(pc_, parena_);
+}
+
+/* Drops every element of a container at once. Only types that need a
+   destructor (patches hold a face set) are visited one by one. */
+template<class C, class T>
+void Mesh::release(C& c, ObjectArena<T>& arena)
+{
+    if (!std::is_trivially_destructible<T>::value)
+        for (typename C::iterator p = c.begin(); p != c.end(); p++)
+            if (arena.owns(*p)) (*p)->~T();
+    c.clear();
+    arena.release();
+}
+
+void Mesh::reserve(int verts, int edges, int faces)
+{
+    varena_.reserve(verts);
+    earena_.reserve(edges);
+    farena_.reserve(faces);
+}
+
+int Mesh::vertex_slots()
+{
+    int n = 0;
+    for (VertexIter v = vc_.begin(); v != vc_.end(); v++)
+        n = std::max(n, (*v)->index + 1);
+    return n;
+}
+
+int Mesh::face_slots()
+{
+    int n = 0;
     for (FaceIter f = fc_.begin(); f != fc_.end(); f++)
-        delete *f;
-    fc_.clear();
-    for (PatchIter p = pc_.begin(); p != pc_.end(); p++)
-        delete *p;
-    pc_.clear();
+        n = std::max(n, (*f)->index + 1);
+    return n;
+}
+
+void Mesh::request_attributes(unsigned attributes)
+{
+    attributes_ |= attributes;
+    fit_attributes(vertex_slots(), face_slots());
+}
+
+void Mesh::release_attributes(unsigned attributes)
+{
+    attributes_ &= ~attributes;
+    if (attributes & ATTR_TEXCOORDS) {
+        std::vector<Vector3>().swap(texcoords_);
+        std::vector<FaceTexCoords>().swap(face_texcoords_);
+    }
+    if (attributes & ATTR_SECONDARY) {
+        std::vector<Vector3>().swap(positions2_);
+        std::vector<Vector3>().swap(normals2_);
+    }
+    if (attributes & ATTR_CURVATURE)
+        std::vector<Curvature>().swap(curvatures_);
+}
+
+void Mesh::fit_attributes(int verts, int faces)
+{
+    if ((attributes_ & ATTR_TEXCOORDS) && (int)texcoords_.size() < verts)
+        texcoords_.resize(verts);
+    if ((attributes_ & ATTR_TEXCOORDS) && (int)face_texcoords_.size() < faces)
+        face_texcoords_.resize(faces);
+    if ((attributes_ & ATTR_SECONDARY) && (int)positions2_.size() < verts) {
+        positions2_.resize(verts);
+        normals2_.resize(verts);
+    }
+    if ((attributes_ & ATTR_CURVATURE) && (int)curvatures_.size() < verts)
+        curvatures_.resize(verts);
+}
+
+/* Container entries count as a pointer in an indexed container and as a
+   red-black tree node (three links, a colour and the pointer) in a set. */
+MeshMemoryReport Mesh::memory_layout(unsigned attributes)
+{
+#ifdef A48_INDEXED_CONTAINERS
+    const size_t entry = sizeof(void*);
+#else
+    const size_t entry = 5 * sizeof(void*);
+#endif
+    MeshMemoryReport r;
+    r.attributes = attributes;
+    r.vertex_bytes = sizeof(Vertex) + entry;
+    r.face_bytes = sizeof(Face) + entry;
+    r.edge_bytes = sizeof(Edge) + entry;
+    r.total = 0;
+    if (attributes & ATTR_TEXCOORDS) {
+        r.vertex_bytes += sizeof(Vector3);
+        r.face_bytes += sizeof(FaceTexCoords);
+    }
+    if (attributes & ATTR_SECONDARY)
+        r.vertex_bytes += 2 * sizeof(Vector3);
+    if (attributes & ATTR_CURVATURE)
+        r.vertex_bytes += sizeof(Curvature);
+    return r;
+}
+
+MeshMemoryReport Mesh::memory_report()
+{
+    MeshMemoryReport r = memory_layout(attributes_);
+    r.total = num_verts() * r.vertex_bytes + num_faces() * r.face_bytes + num_edges() * r.edge_bytes;
+    return r;
+}
+
+void Mesh::print_memory_layouts(std::ostream& out)
+{
+    for (unsigned a = 0; a <= ATTR_ALL; a++)
+        memory_layout(a).print(out);
+}
+
+void MeshMemoryReport::print(std::ostream& out) const
+{
+    out << ((attributes & ATTR_TEXCOORDS) ? "texcoords " : "")
+        << ((attributes & ATTR_SECONDARY) ? "secondary " : "")
+        << ((attributes & ATTR_CURVATURE) ? "curvature " : "")
+        << (attributes ? "" : "no attributes ")
+        << "- vertex " << vertex_bytes << " B, face " << face_bytes
+        << " B, edge " << edge_bytes << " B";
+    if (total) out << ", total " << total << " B";
+    out << std::endl;
 }
 
 void Mesh::delete_patches()
 {
     for (PatchIter p = pc_.begin(); p != pc_.end(); p++)
-        delete *p;
+        parena_.destroy(*p);
     pc_.clear();
 }
 
 Patch* Mesh::add_patch()
 {
-    Patch *p = new Patch();
+    Patch *p = parena_.create();
 
-    p->index = pc_.size();
+    p->index = next_index(pc_);
 
     add_patch(p);
     return p;
@@ -138,7 +346,7 @@ Patch* Mesh::add_patch()
 
 Patch* Mesh::add_patch(int *i, int size, FaceMap* faces, int , float *)
 {
-    Patch *p = new Patch();
+    Patch *p = parena_.create();
 
     for (int j = 0; j < size; j++)
     {
@@ -148,15 +356,15 @@ Patch* Mesh::add_patch(int *i, int size, FaceMap* faces, int , float *)
         p->add_face_patch(f);
     }
 
-    p->index = pc_.size();
+    p->index = next_index(pc_);
     add_patch(p);
     return p;
 }
 
 Face* Mesh::add_face(Hedge *e0, Hedge *e1, Hedge *e2)
 {
-    Face *f = new Face(e0, e1, e2);
-    f->index = fc_.size();
+    Face *f = farena_.create(e0, e1, e2);
+    f->index = next_index(fc_);
     add_face(f);
 
     return f;
@@ -164,23 +372,31 @@ Face* Mesh::add_face(Hedge *e0, Hedge *e1, Hedge *e2)
 
 Face* Mesh::add_face(Hedge *e0, Hedge *e1, Hedge *e2, float v0, float v1, float v2, float v3, float v4, float v5)
 {
-    Face *f = new Face(e0, e1, e2, v0, v1, v2, v3, v4, v5);
-    f->index = fc_.size();
+    Face *f = farena_.create(e0, e1, e2);
+    f->index = next_index(fc_);
+    if (!(attributes_ & ATTR_TEXCOORDS)) request_attributes(ATTR_TEXCOORDS);
     add_face(f);
 
+    FaceTexCoords& t = face_texcoords_[f->index];
+    t.t[0] = Vector3(v0, v1, 0);
+    t.t[1] = Vector3(v2, v3, 0);
+    t.t[2] = Vector3(v4, v5, 0);
+
     return f;
 }
 
 Hedge* Mesh::add_edge(Vertex *v0, Vertex *v1)
 {
-    Edge *e = new Edge(v0, v1);
+    Edge *e = earena_.create(v0, v1);
+    e->index = next_index(ec_);
     add_edge(e);
     return e->hedge(0);
 }
 
 Vertex* Mesh::add_vertex(void)
 {
-    Vertex *v = new Vertex();
+    Vertex *v = varena_.create();
+    v->index = next_index(vc_);
     add_vertex(v);
     return v;
 }
@@ -207,6 +423,157 @@ void Mesh::link_mesh()
     }
 }
 
+/* LSD radix sort of 64-bit edge keys on 16-bit digits, carrying the
+   slots along and skipping digits that never vary. Stable, so equal keys
+   keep their slot order. */
+inline void sort_edge_keys(std::vector<unsigned long long>& keys, std::vector<int>& slots)
+{
+    int n = (int)keys.size();
+    std::vector<unsigned long long> keys_tmp(n);
+    std::vector<int> slots_tmp(n);
+    for (int shift = 0; shift < 64; shift += 16) {
+        std::vector<int> count(1 << 16, 0);
+        for (int i = 0; i < n; i++)
+            count[(keys[i] >> shift) & 0xffff]++;
+        if (n == 0 || count[(keys[0] >> shift) & 0xffff] == n)
+            continue;
+        int sum = 0;
+        for (int d = 0; d < (1 << 16); d++) { int c = count[d]; count[d] = sum; sum += c; }
+        for (int i = 0; i < n; i++) {
+            int d = (keys[i] >> shift) & 0xffff;
+            keys_tmp[count[d]] = keys[i];
+            slots_tmp[count[d]++] = slots[i];
+        }
+        keys.swap(keys_tmp);
+        slots.swap(slots_tmp);
+    }
+}
+
+/* The three half edges of face f are slots 3f, 3f+1, 3f+2, going from
+   i1 to i2, i2 to i0 and i0 to i1 as in put_face. Slots are sorted by
+   their undirected edge key with a radix sort; each run of equal keys
+   becomes one Edge, and a slot takes hedge(0) when it goes from the
+   smaller vertex index to the larger one, like get_hedge. Edges and
+   faces are constructed in place in arena blocks on the threads, with
+   the indices put_face would give them; only their insertion in the
+   mesh containers is serial. Faces of a non-manifold edge share a half
+   edge, and are then constructed serially in face order, so that the
+   last one links it as in put_face. */
+bool Mesh::build(Vertex* verts[], int nverts, const int* tris, int nfaces, ThreadPool* pool)
+{
+    ThreadPool serial(1);
+    if (!pool) pool = &serial;
+    const int CHUNK = 4096;
+
+    int nslots = 3 * nfaces;
+    for (int i = 0; i < nslots; i++)
+        if (tris[i] < 0 || tris[i] >= nverts)
+            return false;
+
+    std::vector<unsigned long long> keys(nslots);
+    std::vector<int> slots(nslots);
+
+    pool->parallel_for(nfaces, CHUNK, [&](int begin, int end, int) {
+        for (int f = begin; f < end; f++) {
+            const int* t = tris + 3*f;
+            for (int k = 0; k < 3; k++) {
+                unsigned a = t[NEXT3(k)], b = t[PREV3(k)];
+                if (a > b) std::swap(a, b);
+                keys[3*f + k] = ((unsigned long long)a << 32) | b;
+                slots[3*f + k] = 3*f + k;
+            }
+        }
+    });
+
+    sort_edge_keys(keys, slots);
+
+    std::vector<int> run_start;
+    for (int i = 0; i < nslots; i++)
+        if (i == 0 || keys[i] != keys[i-1]) run_start.push_back(i);
+    int nedges = (int)run_start.size();
+    run_start.push_back(nslots);
+
+    // one edge per run of equal keys, and the edge half of every slot; a
+    // run with two slots on the same half is a non-manifold edge
+    Edge* edges = earena_.allocate_block(nedges);
+    int first_edge = next_index(ec_);
+    std::vector<Hedge*> hedge_of(nslots);
+    std::atomic<int> shared_hedges(0);
+    pool->parallel_for(nedges, CHUNK, [&](int begin, int end, int) {
+        int shared = 0;
+        for (int e = begin; e < end; e++) {
+            unsigned long long key = keys[run_start[e]];
+            Edge* edge = new (edges + e) Edge(verts[(int)(key >> 32)], verts[(int)(key & 0xffffffffu)]);
+            edge->index = first_edge + e;
+            Hedge* h = edge->hedge(0);
+            int forward = 0;
+            for (int k = run_start[e]; k < run_start[e + 1]; k++) {
+                int s = slots[k];
+                const int* t = tris + 3*(s / 3);
+                bool up = t[NEXT3(s % 3)] < t[PREV3(s % 3)];
+                hedge_of[s] = up ? h : h->mate();
+                forward += up;
+            }
+            int n = run_start[e + 1] - run_start[e];
+            if (forward > 1 || n - forward > 1) shared++;
+        }
+        shared_hedges += shared;
+    });
+    for (int e = 0; e < nedges; e++)
+        add_edge(edges + e);
+
+    Face* faces = farena_.allocate_block(nfaces);
+    int first_face = next_index(fc_);
+    auto construct_faces = [&](int begin, int end, int) {
+        for (int f = begin; f < end; f++) {
+            Face* face = new (faces + f) Face(hedge_of[3*f], hedge_of[3*f + 1], hedge_of[3*f + 2]);
+            face->index = first_face + f;
+        }
+    };
+    if (shared_hedges == 0)
+        pool->parallel_for(nfaces, CHUNK, construct_faces);
+    else
+        construct_faces(0, nfaces, 0);
+    for (int f = 0; f < nfaces; f++)
+        add_face(faces + f);
+
+    // star pointers: the hedge into each vertex of its last boundary
+    // slot, which starts its fan as in link_mesh, or else the first hedge
+    // leaving it; the extreme slots are kept per vertex, so that
+    // non-manifold vertices get the same star whatever the threads
+    std::vector<std::atomic<int> > first_out(nverts), last_bdry(nverts);
+    pool->parallel_for(nverts, CHUNK, [&](int begin, int end, int) {
+        for (int v = begin; v < end; v++) {
+            first_out[v].store(nslots, std::memory_order_relaxed);
+            last_bdry[v].store(-1, std::memory_order_relaxed);
+        }
+    });
+    pool->parallel_for(nslots, CHUNK, [&](int begin, int end, int) {
+        for (int s = begin; s < end; s++) {
+            const int* t = tris + 3*(s / 3);
+            std::atomic<int>& first = first_out[t[s % 3]];
+            int cur = first.load(std::memory_order_relaxed);
+            while (s < cur && !first.compare_exchange_weak(cur, s, std::memory_order_relaxed)) {}
+            if (hedge_of[s]->mate()->face() == NULL) {
+                std::atomic<int>& last = last_bdry[t[PREV3(s % 3)]];
+                cur = last.load(std::memory_order_relaxed);
+                while (s > cur && !last.compare_exchange_weak(cur, s, std::memory_order_relaxed)) {}
+            }
+        }
+    });
+    pool->parallel_for(nverts, CHUNK, [&](int begin, int end, int) {
+        for (int v = begin; v < end; v++) {
+            int b = last_bdry[v].load(std::memory_order_relaxed);
+            int s = first_out[v].load(std::memory_order_relaxed);
+            if (b >= 0)
+                verts[v]->set_star(hedge_of[b]);
+            else if (s < nslots)
+                verts[v]->set_star(hedge_of[3*(s / 3) + NEXT3(s % 3)]);
+        }
+    });
+    return true;
+}
+
 Hedge* Mesh::get_hedge(int i0, int i1, Vertex* verts[], HedgeMap *hedges)
 {
     bool mate = false;
@@ -245,7 +612,7 @@ void Mesh::put_face(int i0, int i1, int i2, Vertex* verts[], HedgeMap* hedges, F
     Hedge* e2 = get_hedge(i0, i1, verts, hedges);
 
     Face *f = add_face(e0, e1, e2);
-    (*faces)[(int)fc_.size() - 1] = f;
+    (*faces)[f->index] = f;
 }
 
 void Mesh::put_face(int i0, int i1, int i2, float v0, float v1, float v2, float v3, float v4, float v5, Vertex* verts[], HedgeMap* hedges, FaceMap* faces)
@@ -255,7 +622,7 @@ void Mesh::put_face(int i0, int i1, int i2, float v0, float v1, float v2, float
     Hedge* e2 = get_hedge(i0, i1, verts, hedges);
 
     Face *f = add_face(e0, e1, e2, v0, v1, v2, v3, v4, v5);
-    (*faces)[(int)fc_.size() - 1] = f;
+    (*faces)[f->index] = f;
 }
 
 void Mesh::remove_patch(Patch *p)
@@ -12,13 +12,25 @@ class MeshGeometry
 		static vector<Face*> get_neighbours(Face* f);
 		static Hedge* other_hedge( Edge* e, Hedge* h );
 
+		// fills the ATTR_CURVATURE attributes, requesting them if needed
 		static void calculate_curvatures(Mesh& mesh);
 		static double calculate_mixed_area(Vertex* v);
-		static double calculate_mean_curvature(Vertex* v);
+		static double calculate_mean_curvature(Vertex* v, double mixed_area);
 		static double calculate_gauss_curvature(Vertex* v);
+		// mean of the curvatures at the corners of f
+		static double get_mean_curvature(Mesh& mesh, Face* f);
 
 		static Vector3 get_hedge_vector(Hedge* h);
 		static double get_opposed_angle(Hedge* m0);
+
+		// same on a CompactMesh, which has no per-vertex attributes: the
+		// results go to arrays indexed by vertex
+		static double get_diameter(CompactMesh& mesh);
+		static void calculate_curvatures(CompactMesh& mesh, vector<double>& mixed_area, vector<double>& mean_curvature);
+		static double calculate_mixed_area(CompactMesh& mesh, int v);
+		static double calculate_mean_curvature(CompactMesh& mesh, int v, double mixed_area);
+		static Vector3 get_hedge_vector(CompactMesh& mesh, int h);
+		static double get_opposed_angle(CompactMesh& mesh, int m0);
 };
 
 using namespace std;
@@ -73,22 +85,25 @@ vector<Face*> MeshGeometry::get_neighbours(Face* f)
 
 void MeshGeometry::calculate_curvatures(Mesh& mesh)
 {
+	mesh.request_attributes( ATTR_CURVATURE );
+
 	for(VertexIter v = mesh.verts_begin(); v != mesh.verts_end(); v++)
 	{
 		Vertex* vv = *v;
+		Curvature& c = mesh.curvature( vv );
 		if ( ! vv->is_bdry() )
 		{
-			vv->a.mixed_area = calculate_mixed_area( vv );
+			c.mixed_area = calculate_mixed_area( vv );
 
-		//	cout << "vertex = " << vv->a.g << " - mixed area = " << vv->a.mixed_area;
-			vv->a.mean_curvature = calculate_mean_curvature( vv );
-		//	cout << " mean curv = " << vv->a.mean_curvature << endl;
-			vv->a.gauss_curvature = calculate_gauss_curvature( vv );
+		//	cout << "vertex = " << vv->a.g << " - mixed area = " << c.mixed_area;
+			c.mean_curvature = calculate_mean_curvature( vv, c.mixed_area );
+		//	cout << " mean curv = " << c.mean_curvature << endl;
+			c.gauss_curvature = calculate_gauss_curvature( vv );
 		}
 		else
 		{
-			vv->a.mean_curvature = 0;
-			vv->a.gauss_curvature = 0;
+			c.mean_curvature = 0;
+			c.gauss_curvature = 0;
 
 		}
 	}
@@ -131,7 +146,7 @@ double MeshGeometry::calculate_mixed_area(Vertex* vi)
 	return area;
 }
 
-double MeshGeometry::calculate_mean_curvature(Vertex* vi)
+double MeshGeometry::calculate_mean_curvature(Vertex* vi, double mixed_area)
 {
 	Vector3 curv = 0;
 	for (Hedge* h = vi->star_first(); h != NULL; h = vi->star_next(h) )
@@ -146,7 +161,7 @@ double MeshGeometry::calculate_mean_curvature(Vertex* vi)
 		// Assuming Voronoi Region
 		curv += vv * ( .5 * ( 1.0 / tan( aij ) + 1.0 / tan( bij ) ) );
 	}
-	curv *= 1.0 / vi->a.mixed_area;
+	curv *= 1.0 / mixed_area;
 	Vector3 a( curv.x / curv.z, curv.y / curv.z, 0 );
 //	cout << curv << " x " << a << endl;
 	return .5 * curv.norm();
@@ -157,4 +172,96 @@ double MeshGeometry::calculate_gauss_curvature(Vertex* )
 	return 0;
 }
 
+double MeshGeometry::get_mean_curvature(Mesh& mesh, Face* f)
+{
+	return 1/3. * ( mesh.curvature( f->vertex(0) ).mean_curvature
+		+ mesh.curvature( f->vertex(1) ).mean_curvature
+		+ mesh.curvature( f->vertex(2) ).mean_curvature );
+}
+
+double MeshGeometry::get_diameter(CompactMesh& mesh)
+{
+	double minx=INF, maxx=-INF, miny=INF, maxy=-INF, minz=INF, maxz=-INF;
+
+	for (int v = 0; v < mesh.num_verts(); v++)
+	{
+		Vector3& p = mesh.positions[v];
+		minx = min( minx, (double) p.x );
+		maxx = max( maxx, (double) p.x );
+		miny = min( miny, (double) p.y );
+		maxy = max( maxy, (double) p.y );
+		minz = min( minz, (double) p.z );
+		maxz = max( maxz, (double) p.z );
+	}
+	
+	Vector3 q( maxx - minx, maxy - miny, maxz - minz );
+	return q.norm();
+}
+
+void MeshGeometry::calculate_curvatures(CompactMesh& mesh, vector<double>& mixed_area, vector<double>& mean_curvature)
+{
+	mixed_area.assign( mesh.num_verts(), 0 );
+	mean_curvature.assign( mesh.num_verts(), 0 );
+
+	for (int v = 0; v < mesh.num_verts(); v++)
+	{
+		int s = mesh.star_first( v );
+		if ( s >= 0 && ! mesh.is_bdry( s ) )
+		{
+			mixed_area[v] = calculate_mixed_area( mesh, v );
+			mean_curvature[v] = calculate_mean_curvature( mesh, v, mixed_area[v] );
+		}
+	}
+}
+
+Vector3 MeshGeometry::get_hedge_vector(CompactMesh& mesh, int h)
+{
+	return ( mesh.positions[ mesh.dst(h) ] - mesh.positions[ mesh.org(h) ] );
+}
+
+// the mate of the second half edge is never looked up, its vector is
+// just the opposite one, so this also works next to the boundary
+double MeshGeometry::get_opposed_angle(CompactMesh& mesh, int m0)
+{
+	int m1 = CompactMesh::next( m0 );
+	int m2 = CompactMesh::next( m1 );
+
+	Vector3 v1 = get_hedge_vector( mesh, m1 ) * -1;
+	Vector3 v2 = get_hedge_vector( mesh, m2 );
+
+	return acos( (v1*v2) / (v1.norm()*v2.norm()) );
+}
+
+double MeshGeometry::calculate_mixed_area(CompactMesh& mesh, int vi)
+{
+	double area = 0;
+	for (int h = mesh.star_first(vi); h >= 0; h = mesh.star_next(vi, h) )
+	{
+		double aij = get_opposed_angle( mesh, h );
+		double bij = get_opposed_angle( mesh, mesh.mate(h) );
+
+		Vector3 vv = get_hedge_vector( mesh, h );
+		// Assuming Voronoi Region
+		area += .125 * ( 1.0 / tan( aij ) + 1.0 / tan( bij ) ) * vv.norm2();
+	}
+	return area;
+}
+
+double MeshGeometry::calculate_mean_curvature(CompactMesh& mesh, int vi, double mixed_area)
+{
+	Vector3 curv = 0;
+	for (int h = mesh.star_first(vi); h >= 0; h = mesh.star_next(vi, h) )
+	{
+		double aij = get_opposed_angle( mesh, h );
+		double bij = get_opposed_angle( mesh, mesh.mate(h) );
+
+		Vector3 vv = get_hedge_vector( mesh, h );
+		vv *= -1;
+		// Assuming Voronoi Region
+		curv += vv * ( .5 * ( 1.0 / tan( aij ) + 1.0 / tan( bij ) ) );
+	}
+	curv *= 1.0 / mixed_area;
+	return .5 * curv.norm();
+}
+
 #endif
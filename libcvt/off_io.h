@@ -0,0 +1,456 @@
+#ifndef OFF_IO_H
+#define OFF_IO_H
+
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#if __cplusplus >= 201703L
+#include <charconv>
+#endif
+
+#include "a48.h"
+#include "mapped_file.h"
+
+namespace libcvd {
+
+	inline unsigned RGB(double x) {
+		return  (x < 0) ? 0 : (x > 255) ? 255 : unsigned(x);
+	}
+
+	/* Mesh read from an OFF file as flat arrays. The vertex indices of face
+	   i are face_indices[face_offsets[i]] .. face_indices[face_offsets[i+1] - 1]. */
+	struct OffData {
+		std::vector<double> positions;   // 3 per vertex
+		std::vector<double> normals;     // 3 per vertex, NOFF only
+		std::vector<double> colors;      // 3 per vertex in [0, 1], COFF only
+		std::vector<int> face_offsets;
+		std::vector<int> face_indices;
+		int number_of_edges;
+
+		OffData() : number_of_edges(0) {}
+
+		int num_verts() const { return (int)positions.size() / 3; }
+		int num_faces() const { return face_offsets.empty() ? 0 : (int)face_offsets.size() - 1; }
+		bool has_normals() const { return !normals.empty(); }
+		bool has_colors() const { return !colors.empty(); }
+		void clear();
+	};
+
+	// Reads an OFF, NOFF or COFF file through a memory map; threads as for
+	// ThreadPool, 0 for all cores.
+	bool load_off(const std::string& filename, OffData& off, int threads = 1);
+	// Same on a buffer already in memory.
+	bool parse_off(const char* begin, const char* end, OffData& off, A48::ThreadPool* pool);
+
+	// Writes an OFF file, or COFF when colors (3 per vertex in [0, 1]) are
+	// given. Faces are polygons as in OffData, or triangles of 3 indices
+	// each when face_offsets is NULL. Coordinates are printed like %g with
+	// the given number of significant digits, at most 17, which already
+	// reads back to the same double, or 0 for the shortest such text.
+	// Blocks of lines are formatted on threads (as for ThreadPool, 0 for
+	// all cores) and written in order.
+	bool write_off(const std::string& filename, const double* positions, int nverts,
+		const int* face_offsets, const int* face_indices, int nfaces,
+		const double* colors = NULL, int precision = 6, int threads = 1);
+	bool write_off(const std::string& filename, const OffData& off, int precision = 6, int threads = 1);
+	template<class P, class C, class F>
+	bool write_off_from(const std::string& filename, int nverts, int nfaces, bool has_colors,
+		P position, C color, F face, int precision, int threads);
+
+
+	/* implementation */
+
+	inline void OffData::clear()
+	{
+		positions.clear(); normals.clear(); colors.clear();
+		face_offsets.clear(); face_indices.clear();
+		number_of_edges = 0;
+	}
+
+	inline const char* off_skip_blanks(const char* p, const char* end)
+	{
+		while (p != end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+		return p;
+	}
+
+	inline const char* off_next_line(const char* p, const char* end)
+	{
+		const char* n = (const char*)memchr(p, '\n', end - p);
+		return n ? n + 1 : end;
+	}
+
+	// a line holding something else than blanks or a # comment
+	inline bool off_is_data_line(const char* p, const char* end)
+	{
+		p = off_skip_blanks(p, end);
+		return p != end && *p != '\n' && *p != '#';
+	}
+
+	inline bool off_parse_int(const char*& p, const char* end, int& v)
+	{
+		p = off_skip_blanks(p, end);
+		bool neg = (p != end && *p == '-');
+		if (p != end && (*p == '-' || *p == '+')) p++;
+		if (p == end || *p < '0' || *p > '9') return false;
+		// every digit is consumed; past the int range x stops growing
+		long long x = 0;
+		bool overflow = false;
+		for (; p != end && *p >= '0' && *p <= '9'; p++)
+		{
+			x = 10 * x + (*p - '0');
+			if (x > 0x80000000ll) { overflow = true; x = 0x80000000ll; }
+		}
+		if (overflow || x > (neg ? 0x80000000ll : 0x7fffffffll))
+			return false;
+		v = (int)(neg ? -x : x);
+		return true;
+	}
+
+	inline bool off_parse_double(const char*& p, const char* end, double& v)
+	{
+		p = off_skip_blanks(p, end);
+		if (p != end && *p == '+') p++;
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+		std::from_chars_result r = std::from_chars(p, end, v);
+		if (r.ec != std::errc()) return false;
+		p = r.ptr;
+		return true;
+#else
+		// strtod needs a terminated string, and the mapped file has none
+		char buf[64];
+		size_t n = 0;
+		while (p + n != end && n < sizeof(buf) - 1 && !strchr(" \t\r\n#", p[n])) n++;
+		memcpy(buf, p, n);
+		buf[n] = 0;
+		char* e;
+		v = strtod(buf, &e);
+		if (e == buf) return false;
+		p += e - buf;
+		return true;
+#endif
+	}
+
+	/* The header and the counts line are read serially. The body is then
+	   cut into chunks of whole lines and read in three parallel passes:
+	   count the data lines of every chunk, which gives the global line
+	   number where each chunk starts; read the vertices and the valence of
+	   every face; read the face indices into place once the valences are
+	   summed into offsets. Comment and blank lines are skipped anywhere. */
+	inline bool parse_off(const char* begin, const char* end, OffData& off, A48::ThreadPool* pool)
+	{
+		off.clear();
+
+		const char* p = begin;
+		while (p != end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) p++;
+		const char* h = p;
+		while (p != end && !strchr(" \t\r\n", *p)) p++;
+		std::string header(h, p);
+
+		bool has_normals = header.compare(0, 4, "NOFF") == 0;
+		bool has_vertexColors = header.compare(0, 4, "COFF") == 0;
+		if (!has_normals && !has_vertexColors && header.compare(0, 3, "OFF") != 0)
+		{
+			fprintf(stderr, "Error: readOFF() first line should be OFF or NOFF or COFF, not %s\n", header.c_str());
+			return false;
+		}
+
+		// counts, on the header line or on the first line that is not a comment
+		if (!off_is_data_line(p, end))
+		{
+			p = off_next_line(p, end);
+			while (p != end && !off_is_data_line(p, end))
+				p = off_next_line(p, end);
+		}
+		int number_of_vertices, number_of_faces;
+		if (!off_parse_int(p, end, number_of_vertices) || !off_parse_int(p, end, number_of_faces)
+			|| number_of_vertices < 0 || number_of_faces < 0)
+		{
+			fprintf(stderr, "Error: readOFF() bad vertex and face counts\n");
+			return false;
+		}
+		if (!off_parse_int(p, end, off.number_of_edges))
+			off.number_of_edges = 0;
+		const char* body = off_next_line(p, end);
+
+		int nv = number_of_vertices, nf = number_of_faces;
+		off.positions.resize(3 * (size_t)nv);
+		if (has_normals) off.normals.resize(3 * (size_t)nv);
+		if (has_vertexColors) off.colors.resize(3 * (size_t)nv);
+		off.face_offsets.assign((size_t)nf + 1, 0);
+
+		// chunks of whole lines, about CHUNK_BYTES each
+		const size_t CHUNK_BYTES = 1 << 22;
+		size_t body_size = end - body;
+		int nchunks = (int)((body_size + CHUNK_BYTES - 1) / CHUNK_BYTES);
+		if (nchunks < 1) nchunks = 1;
+		std::vector<const char*> bounds(nchunks + 1);
+		bounds[0] = body;
+		bounds[nchunks] = end;
+		for (int c = 1; c < nchunks; c++)
+		{
+			const char* b = body + c * CHUNK_BYTES;
+			b = (b[-1] == '\n') ? b : off_next_line(b, end);
+			bounds[c] = (b > bounds[c-1]) ? b : bounds[c-1];
+		}
+
+		std::vector<long long> first_line(nchunks + 1, 0);
+		pool->parallel_for(nchunks, 1, [&](int cb, int ce, int) {
+			for (int c = cb; c < ce; c++)
+			{
+				long long n = 0;
+				for (const char* l = bounds[c]; l != bounds[c+1]; l = off_next_line(l, bounds[c+1]))
+					if (off_is_data_line(l, bounds[c+1])) n++;
+				first_line[c+1] = n;
+			}
+		});
+		for (int c = 0; c < nchunks; c++)
+			first_line[c+1] += first_line[c];
+		if (first_line[nchunks] < (long long)nv + nf)
+		{
+			fprintf(stderr, "Error: readOFF() expected %d vertices and %d faces, the file ends after %lld lines\n",
+				nv, nf, first_line[nchunks]);
+			return false;
+		}
+
+		// first bad line of each chunk, or -1
+		std::vector<long long> bad(nchunks, -1);
+		for (int pass = 0; pass < 2; pass++)
+		{
+			pool->parallel_for(nchunks, 1, [&](int cb, int ce, int) {
+				for (int c = cb; c < ce; c++)
+				{
+					long long g = first_line[c];
+					if (pass == 1 && (g + (first_line[c+1] - first_line[c]) <= nv || g >= (long long)nv + nf))
+						continue;
+					for (const char* l = bounds[c]; l != bounds[c+1] && bad[c] < 0; l = off_next_line(l, bounds[c+1]))
+					{
+						if (!off_is_data_line(l, bounds[c+1])) continue;
+						const char* q = l;
+						const char* e = bounds[c+1];
+						if (g < nv && pass == 0)
+						{
+							double* x = &off.positions[3*g];
+							bool ok = off_parse_double(q, e, x[0]) && off_parse_double(q, e, x[1]) && off_parse_double(q, e, x[2]);
+							if (ok && has_normals)
+							{
+								double* n = &off.normals[3*g];
+								ok = off_parse_double(q, e, n[0]) && off_parse_double(q, e, n[1]) && off_parse_double(q, e, n[2]);
+							}
+							if (ok && has_vertexColors)
+							{
+								double* k = &off.colors[3*g];
+								ok = off_parse_double(q, e, k[0]) && off_parse_double(q, e, k[1]) && off_parse_double(q, e, k[2]);
+								k[0] /= 255.0; k[1] /= 255.0; k[2] /= 255.0;
+							}
+							if (!ok) bad[c] = g;
+						}
+						else if (g >= nv && g < (long long)nv + nf)
+						{
+							int f = (int)(g - nv);
+							int valence;
+							if (!off_parse_int(q, e, valence) || valence < 0) { bad[c] = g; continue; }
+							if (pass == 0)
+							{
+								// each index takes a blank and a digit at least, so the
+								// rest of the line bounds the valence
+								if (valence > (off_next_line(q, e) - q) / 2) { bad[c] = g; continue; }
+								off.face_offsets[f + 1] = valence;
+							}
+							else
+							{
+								int* idx = &off.face_indices[off.face_offsets[f]];
+								for (int j = 0; j < valence; j++)
+									if (!off_parse_int(q, e, idx[j]) || idx[j] < 0 || idx[j] >= nv) { bad[c] = g; break; }
+							}
+						}
+						g++;
+					}
+				}
+			});
+
+			for (int c = 0; c < nchunks; c++)
+				if (bad[c] >= 0)
+				{
+					fprintf(stderr, "Error: bad line (%lld)\n", bad[c]);
+					return false;
+				}
+
+			if (pass == 0)
+			{
+				long long total = 0;
+				for (int f = 0; f < nf; f++)
+				{
+					total += off.face_offsets[f + 1];
+					if (total > INT_MAX)
+					{
+						fprintf(stderr, "Error: readOFF() too many face indices\n");
+						return false;
+					}
+					off.face_offsets[f + 1] = (int)total;
+				}
+				off.face_indices.resize((size_t)total);
+			}
+		}
+		return true;
+	}
+
+	/* Growable text buffer written through raw pointers: reserve room for
+	   a line, print into it and commit the end. */
+	struct OffTextBuffer {
+		std::vector<char> data;
+		size_t size;
+
+		OffTextBuffer() : size(0) {}
+
+		char* reserve(size_t n)
+		{
+			if (size + n > data.size()) data.resize(std::max(2 * data.size(), size + n));
+			return &data[size];
+		}
+		void commit(char* end) { size = end - &data[0]; }
+	};
+
+	// 17 significant digits print a double exactly, and fit with sign,
+	// point and exponent in OFF_DOUBLE_CHARS
+	enum { OFF_DOUBLE_CHARS = 32, OFF_INT_CHARS = 12, OFF_MAX_PRECISION = 17 };
+
+	inline char* off_format_double(char* p, double v, int precision)
+	{
+		if (precision > OFF_MAX_PRECISION) precision = OFF_MAX_PRECISION;
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+		if (precision > 0)
+			return std::to_chars(p, p + OFF_DOUBLE_CHARS, v, std::chars_format::general, precision).ptr;
+		return std::to_chars(p, p + OFF_DOUBLE_CHARS, v).ptr;
+#else
+		return p + snprintf(p, OFF_DOUBLE_CHARS, "%.*g", precision > 0 ? precision : OFF_MAX_PRECISION, v);
+#endif
+	}
+
+	inline char* off_format_int(char* p, long long v)
+	{
+		char tmp[OFF_INT_CHARS];
+		int n = 0;
+		unsigned long long u = (v < 0) ? 0ull - (unsigned long long)v : (unsigned long long)v;
+		do { tmp[n++] = (char)('0' + u % 10); u /= 10; } while (u);
+		if (v < 0) *p++ = '-';
+		while (n) *p++ = tmp[--n];
+		return p;
+	}
+
+	/* Formats lines [0, n) with line(i, buffer) in blocks of BLOCK_LINES,
+	   one batch of blocks per round on the pool, and writes the blocks of
+	   a batch in order before the next round. */
+	template<class F>
+	bool off_write_lines(FILE* file, int n, F line, A48::ThreadPool* pool)
+	{
+		const int BLOCK_LINES = 1 << 15;
+		int nblocks = (n + BLOCK_LINES - 1) / BLOCK_LINES;
+		int batch = std::max(1, 2 * pool->size());
+		std::vector<OffTextBuffer> buffers(std::min(batch, std::max(nblocks, 1)));
+
+		for (int b0 = 0; b0 < nblocks; b0 += batch)
+		{
+			int b1 = std::min(nblocks, b0 + batch);
+			pool->parallel_for(b1 - b0, 1, [&](int begin, int end, int) {
+				for (int b = begin; b < end; b++)
+				{
+					OffTextBuffer& buf = buffers[b];
+					buf.size = 0;
+					int l1 = std::min(n, (b0 + b + 1) * BLOCK_LINES);
+					for (int l = (b0 + b) * BLOCK_LINES; l < l1; l++)
+						line(l, buf);
+				}
+			});
+			for (int b = 0; b < b1 - b0; b++)
+				if (buffers[b].size && fwrite(&buffers[b].data[0], 1, buffers[b].size, file) != buffers[b].size)
+					return false;
+		}
+		return true;
+	}
+
+	/* The mesh is read through position(i) and color(i), which return 3
+	   doubles for vertex i, and face(i, n), which returns the n indices of
+	   face i; color is only called when has_colors is set. */
+	template<class P, class C, class F>
+	bool write_off_from(const std::string& filename, int nverts, int nfaces, bool has_colors,
+		P position, C color, F face, int precision, int threads)
+	{
+		FILE* file = fopen(filename.c_str(), "wb");
+		if (!file) return false;
+		A48::ThreadPool pool(threads);
+
+		char header[64];
+		int len = snprintf(header, sizeof(header), "%s\n%d %d 0\n", has_colors ? "COFF" : "OFF", nverts, nfaces);
+		bool ok = fwrite(header, 1, len, file) == (size_t)len;
+
+		ok = ok && off_write_lines(file, nverts, [&](int i, OffTextBuffer& buf) {
+			char* p = buf.reserve(3 * (OFF_DOUBLE_CHARS + 1) + 3 * OFF_INT_CHARS + 4);
+			const double* x = position(i);
+			p = off_format_double(p, x[0], precision); *p++ = ' ';
+			p = off_format_double(p, x[1], precision); *p++ = ' ';
+			p = off_format_double(p, x[2], precision);
+			if (has_colors)
+			{
+				const double* c = color(i);
+				*p++ = ' '; p = off_format_int(p, RGB(c[0] * 255.0));
+				*p++ = ' '; p = off_format_int(p, RGB(c[1] * 255.0));
+				*p++ = ' '; p = off_format_int(p, RGB(c[2] * 255.0));
+			}
+			*p++ = '\n';
+			buf.commit(p);
+		}, &pool);
+
+		ok = ok && off_write_lines(file, nfaces, [&](int i, OffTextBuffer& buf) {
+			int n;
+			const int* v = face(i, n);
+			char* p = buf.reserve((size_t)(n + 1) * (OFF_INT_CHARS + 1) + 1);
+			p = off_format_int(p, n);
+			for (int k = 0; k < n; k++)
+			{
+				*p++ = ' ';
+				p = off_format_int(p, v[k]);
+			}
+			*p++ = '\n';
+			buf.commit(p);
+		}, &pool);
+
+		ok = (fclose(file) == 0) && ok;
+		return ok;
+	}
+
+	inline bool write_off(const std::string& filename, const double* positions, int nverts,
+		const int* face_offsets, const int* face_indices, int nfaces,
+		const double* colors, int precision, int threads)
+	{
+		return write_off_from(filename, nverts, nfaces, colors != NULL,
+			[&](int i) { return positions + 3 * (size_t)i; },
+			[&](int i) { return colors + 3 * (size_t)i; },
+			[&](int i, int& n) {
+				int b = face_offsets ? face_offsets[i] : 3 * i;
+				n = face_offsets ? face_offsets[i+1] - b : 3;
+				return face_indices + b;
+			},
+			precision, threads);
+	}
+
+	inline bool write_off(const std::string& filename, const OffData& off, int precision, int threads)
+	{
+		return write_off(filename, off.positions.data(), off.num_verts(),
+			off.face_offsets.data(), off.face_indices.data(), off.num_faces(),
+			off.has_colors() ? off.colors.data() : NULL, precision, threads);
+	}
+
+	inline bool load_off(const std::string& filename, OffData& off, int threads)
+	{
+		A48::MappedFile file(filename);
+		if (!file.is_open()) return false;
+		A48::ThreadPool pool(threads);
+		return parse_off(file.data(), file.data() + file.size(), off, &pool);
+	}
+
+}
+
+#endif
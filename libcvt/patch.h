@@ -6,7 +6,7 @@ namespace A48 {
 	class Patch {
 	public:
 
-		FaceContainer fpc_;
+		PatchFaceContainer fpc_;
 		Vector3 center_;
 		Vector3 normal_;
 		Face* center_face;
@@ -15,10 +15,10 @@ namespace A48 {
 
 		int index;
 
-		Patch::Patch()
+		Patch()
 		{}
 
-		Patch::~Patch()
+		~Patch()
 		{
 			fpc_.clear();
 		}
@@ -29,19 +29,18 @@ namespace A48 {
 		Face* get_center_face() { return center_face; }
 		void set_center_face( Face* f ) { center_face = f; }
 
-        FaceIter faces_patch_begin() { return fpc_.begin(); }
-        FaceIter faces_patch_end() { return fpc_.end(); }
+        PatchFaceIter faces_patch_begin() { return fpc_.begin(); }
+        PatchFaceIter faces_patch_end() { return fpc_.end(); }
         int num_faces_patch() { return (int)fpc_.size(); }
 
         void set_index(int indx) {index = indx;}
         int get_index() { return index;}
 
 		bool add_face_patch(Face* f) 
-        { std::pair<FaceIter, bool> r = fpc_.insert(f); return r.second;}
+        { std::pair<PatchFaceIter, bool> r = fpc_.insert(f); return r.second;}
 
 		void del_face_patch(Face* f) {
 			fpc_.erase(f); 
-			delete(f);
 		}
 
 	};
@@ -0,0 +1,466 @@
+#ifndef PLY_IO_H
+#define PLY_IO_H
+
+#include <cstdio>
+#include <atomic>
+#include <climits>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "mapped_file.h"
+#include "off_io.h"
+
+namespace libcvd {
+
+	// Reads a binary PLY file (either byte order) into the flat arrays of
+	// OffData: positions, normals (nx, ny, nz), colors (red, green, blue
+	// as uchar or float) and faces. The per-face region property goes to
+	// face_regions when asked for, -1 for every face when absent.
+	bool load_ply(const std::string& filename, OffData& mesh, std::vector<int>* face_regions = NULL, int threads = 1);
+
+	// Writes a binary little-endian PLY file with double positions, uchar
+	// colors when given (3 per vertex in [0, 1]) and an int region per face
+	// when regions is not NULL. Faces as for write_off.
+	bool write_ply(const std::string& filename, const double* positions, int nverts,
+		const int* face_offsets, const int* face_indices, int nfaces,
+		const double* colors = NULL, const int* regions = NULL);
+	template<class P, class C, class F, class R>
+	bool write_ply_from(const std::string& filename, int nverts, int nfaces, bool has_colors, bool has_regions,
+		P position, C color, F face, R region);
+
+
+	/* implementation */
+
+	enum PlyType { PLY_NONE, PLY_INT8, PLY_UINT8, PLY_INT16, PLY_UINT16, PLY_INT32, PLY_UINT32, PLY_FLOAT32, PLY_FLOAT64 };
+
+	inline PlyType ply_type(const std::string& s)
+	{
+		if (s == "char" || s == "int8") return PLY_INT8;
+		if (s == "uchar" || s == "uint8") return PLY_UINT8;
+		if (s == "short" || s == "int16") return PLY_INT16;
+		if (s == "ushort" || s == "uint16") return PLY_UINT16;
+		if (s == "int" || s == "int32") return PLY_INT32;
+		if (s == "uint" || s == "uint32") return PLY_UINT32;
+		if (s == "float" || s == "float32") return PLY_FLOAT32;
+		if (s == "double" || s == "float64") return PLY_FLOAT64;
+		return PLY_NONE;
+	}
+
+	inline int ply_size(PlyType t)
+	{
+		static const int sizes[] = { 0, 1, 1, 2, 2, 4, 4, 4, 8 };
+		return sizes[t];
+	}
+
+	// value of type t at p, byte-swapped when swap is set
+	template<class T>
+	inline double ply_get(const char* p, bool swap)
+	{
+		T v;
+		if (!swap) { memcpy(&v, p, sizeof(T)); return v; }
+		char b[sizeof(T)];
+		for (size_t i = 0; i < sizeof(T); i++) b[i] = p[sizeof(T) - 1 - i];
+		memcpy(&v, b, sizeof(T));
+		return v;
+	}
+
+	// value of type t at p, byte-swapped when swap is set
+	inline double ply_read(const char* p, PlyType t, bool swap)
+	{
+		switch (t)
+		{
+		case PLY_INT8:    return (signed char)*p;
+		case PLY_UINT8:   return (unsigned char)*p;
+		case PLY_INT16:   return ply_get<short>(p, swap);
+		case PLY_UINT16:  return ply_get<unsigned short>(p, swap);
+		case PLY_INT32:   return ply_get<int>(p, swap);
+		case PLY_UINT32:  return ply_get<unsigned int>(p, swap);
+		case PLY_FLOAT32: return ply_get<float>(p, swap);
+		case PLY_FLOAT64: return ply_get<double>(p, swap);
+		default: return 0;
+		}
+	}
+
+	inline bool ply_host_is_little_endian()
+	{
+		unsigned int one = 1;
+		unsigned char c;
+		memcpy(&c, &one, 1);
+		return c == 1;
+	}
+
+	struct PlyProperty {
+		std::string name;
+		PlyType type;
+		PlyType count_type;   // PLY_NONE unless a list
+		int offset;           // in a fixed-size record, -1 after a list
+	};
+
+	struct PlyElement {
+		std::string name;
+		long long count;
+		std::vector<PlyProperty> properties;
+		int record_size;      // -1 when a list makes records variable
+
+		const PlyProperty* find(const char* n) const
+		{
+			for (size_t i = 0; i < properties.size(); i++)
+				if (properties[i].name == n) return &properties[i];
+			return 0;
+		}
+	};
+
+	// Values of the list property q at p, with their number left in n;
+	// NULL when the count is negative or the values run past end.
+	inline const char* ply_list_values(const PlyProperty& q, const char* p, const char* end, bool swap, long long& n)
+	{
+		if (end - p < ply_size(q.count_type)) return 0;
+		double c = ply_read(p, q.count_type, swap);
+		p += ply_size(q.count_type);
+		if (!(c >= 0) || c > INT_MAX || c > (double)((end - p) / ply_size(q.type))) return 0;
+		n = (long long)c;
+		return p;
+	}
+
+	// End of the record starting at p, NULL when it runs past end; only
+	// records with a list property have to be read.
+	inline const char* ply_skip_record(const PlyElement& e, const char* p, const char* end, bool swap)
+	{
+		if (e.record_size >= 0) return (end - p >= e.record_size) ? p + e.record_size : 0;
+		for (size_t k = 0; k < e.properties.size() && p; k++)
+		{
+			const PlyProperty& q = e.properties[k];
+			if (q.count_type == PLY_NONE)
+			{
+				if (end - p < ply_size(q.type)) return 0;
+				p += ply_size(q.type);
+				continue;
+			}
+			long long n;
+			p = ply_list_values(q, p, end, swap, n);
+			if (p) p += n * ply_size(q.type);
+		}
+		return p;
+	}
+
+	/* The header is parsed as text; vertices, whose records have a fixed
+	   size, are then converted in parallel straight from the map, and
+	   faces are walked once to find their offsets and once to copy the
+	   indices. */
+	inline bool load_ply(const std::string& filename, OffData& mesh, std::vector<int>* face_regions, int threads)
+	{
+		mesh.clear();
+		A48::MappedFile file(filename);
+		if (!file.is_open()) return false;
+		const char* data = file.data();
+		const char* end = data + file.size();
+
+		const char* body = 0;
+		for (const char* p = data; p && p < end; p = off_next_line(p, end))
+			if (end - p >= 10 && memcmp(p, "end_header", 10) == 0) { body = off_next_line(p, end); break; }
+		if (file.size() < 3 || memcmp(data, "ply", 3) != 0 || !body)
+		{
+			fprintf(stderr, "Error: readPLY() not a PLY file\n");
+			return false;
+		}
+
+		std::istringstream header(std::string(data, body));
+		std::string line, format;
+		std::vector<PlyElement> elements;
+		while (std::getline(header, line))
+		{
+			std::istringstream ls(line);
+			std::string word;
+			ls >> word;
+			if (word == "format")
+				ls >> format;
+			else if (word == "element")
+			{
+				PlyElement e;
+				if (!(ls >> e.name >> e.count) || e.count < 0 || e.count > INT_MAX)
+				{
+					fprintf(stderr, "Error: readPLY() bad element count in \"%s\"\n", line.c_str());
+					return false;
+				}
+				e.record_size = 0;
+				elements.push_back(e);
+			}
+			else if (word == "property" && !elements.empty())
+			{
+				PlyElement& e = elements.back();
+				PlyProperty q;
+				std::string type;
+				ls >> type;
+				q.count_type = PLY_NONE;
+				if (type == "list")
+				{
+					std::string count_type;
+					ls >> count_type >> type;
+					q.count_type = ply_type(count_type);
+				}
+				ls >> q.name;
+				q.type = ply_type(type);
+				if (q.type == PLY_NONE || (type == "list" && q.count_type == PLY_NONE))
+				{
+					fprintf(stderr, "Error: readPLY() unknown property type in \"%s\"\n", line.c_str());
+					return false;
+				}
+				q.offset = e.record_size;
+				if (e.record_size >= 0)
+					e.record_size = (q.count_type == PLY_NONE) ? e.record_size + ply_size(q.type) : -1;
+				e.properties.push_back(q);
+			}
+		}
+
+		bool swap;
+		if (format == "binary_little_endian") swap = !ply_host_is_little_endian();
+		else if (format == "binary_big_endian") swap = ply_host_is_little_endian();
+		else
+		{
+			fprintf(stderr, "Error: readPLY() only binary PLY files are supported, not %s\n", format.c_str());
+			return false;
+		}
+
+		A48::ThreadPool pool(threads);
+		const char* p = body;
+		for (size_t ei = 0; ei < elements.size(); ei++)
+		{
+			const PlyElement& e = elements[ei];
+			if (e.name == "vertex")
+			{
+				const PlyProperty* x = e.find("x"); const PlyProperty* y = e.find("y"); const PlyProperty* z = e.find("z");
+				const PlyProperty* nx = e.find("nx"); const PlyProperty* ny = e.find("ny"); const PlyProperty* nz = e.find("nz");
+				const PlyProperty* r = e.find("red"); const PlyProperty* g = e.find("green"); const PlyProperty* b = e.find("blue");
+				if (e.record_size < 0 || !x || !y || !z || e.count * e.record_size > end - p)
+				{
+					fprintf(stderr, "Error: readPLY() bad vertex element\n");
+					return false;
+				}
+				bool normals = nx && ny && nz, colors = r && g && b;
+				double scale = (colors && r->type == PLY_UINT8) ? 1 / 255.0 : 1.0;
+				int nv = (int)e.count;
+				mesh.positions.resize(3 * (size_t)nv);
+				if (normals) mesh.normals.resize(3 * (size_t)nv);
+				if (colors) mesh.colors.resize(3 * (size_t)nv);
+
+				const char* base = p;
+				pool.parallel_for(nv, 1 << 14, [&](int begin, int vend, int) {
+					for (int i = begin; i < vend; i++)
+					{
+						const char* v = base + (size_t)i * e.record_size;
+						double* q = &mesh.positions[3 * (size_t)i];
+						q[0] = ply_read(v + x->offset, x->type, swap);
+						q[1] = ply_read(v + y->offset, y->type, swap);
+						q[2] = ply_read(v + z->offset, z->type, swap);
+						if (normals)
+						{
+							double* n = &mesh.normals[3 * (size_t)i];
+							n[0] = ply_read(v + nx->offset, nx->type, swap);
+							n[1] = ply_read(v + ny->offset, ny->type, swap);
+							n[2] = ply_read(v + nz->offset, nz->type, swap);
+						}
+						if (colors)
+						{
+							double* c = &mesh.colors[3 * (size_t)i];
+							c[0] = scale * ply_read(v + r->offset, r->type, swap);
+							c[1] = scale * ply_read(v + g->offset, g->type, swap);
+							c[2] = scale * ply_read(v + b->offset, b->type, swap);
+						}
+					}
+				});
+				p += e.count * e.record_size;
+			}
+			else if (e.name == "face")
+			{
+				const PlyProperty* list = e.find("vertex_indices");
+				if (!list) list = e.find("vertex_index");
+				const PlyProperty* region = e.find("region");
+				if (!list || list->count_type == PLY_NONE)
+				{
+					fprintf(stderr, "Error: readPLY() faces without vertex_indices\n");
+					return false;
+				}
+
+				int nf = (int)e.count;
+				mesh.face_offsets.assign((size_t)nf + 1, 0);
+				if (face_regions) face_regions->assign(nf, -1);
+
+				// first walk: sizes, regions and where each record starts
+				std::vector<const char*> records(nf);
+				for (int f = 0; f < nf; f++)
+				{
+					records[f] = p;
+					for (size_t k = 0; k < e.properties.size(); k++)
+					{
+						const PlyProperty& q = e.properties[k];
+						if (q.count_type == PLY_NONE)
+						{
+							if (end - p < ply_size(q.type)) { fprintf(stderr, "Error: readPLY() truncated faces\n"); return false; }
+							if (&q == region && face_regions) (*face_regions)[f] = (int)ply_read(p, q.type, swap);
+							p += ply_size(q.type);
+							continue;
+						}
+						long long n;
+						p = ply_list_values(q, p, end, swap, n);
+						if (!p) { fprintf(stderr, "Error: readPLY() bad or truncated face list\n"); return false; }
+						if (&q == list) mesh.face_offsets[f + 1] = (int)n;
+						p += n * ply_size(q.type);
+					}
+				}
+				long long total = 0;
+				for (int f = 0; f < nf; f++)
+				{
+					total += mesh.face_offsets[f + 1];
+					if (total > INT_MAX) { fprintf(stderr, "Error: readPLY() too many face indices\n"); return false; }
+					mesh.face_offsets[f + 1] = (int)total;
+				}
+				mesh.face_indices.resize(mesh.face_offsets[nf]);
+
+				// the list is at the same place in every record once the
+				// properties before it are fixed, which is the common case
+				int skip = 0;
+				for (size_t k = 0; k < e.properties.size() && &e.properties[k] != list; k++)
+					skip = (skip < 0 || e.properties[k].count_type != PLY_NONE) ? -1 : skip + ply_size(e.properties[k].type);
+
+				int nverts = mesh.num_verts();
+				std::atomic<bool> bad_index(false);
+				pool.parallel_for(nf, 1 << 14, [&](int begin, int fend, int) {
+					for (int f = begin; f < fend; f++)
+					{
+						const char* q = records[f];
+						if (skip >= 0)
+							q += skip;
+						else
+							for (size_t k = 0; &e.properties[k] != list; k++)
+							{
+								const PlyProperty& s = e.properties[k];
+								q += (s.count_type == PLY_NONE) ? ply_size(s.type)
+									: ply_size(s.count_type) + (long long)ply_read(q, s.count_type, swap) * ply_size(s.type);
+							}
+						q += ply_size(list->count_type);
+						int* idx = &mesh.face_indices[0] + mesh.face_offsets[f];
+						for (int j = 0; j < mesh.face_offsets[f + 1] - mesh.face_offsets[f]; j++, q += ply_size(list->type))
+						{
+							idx[j] = (int)ply_read(q, list->type, swap);
+							if (idx[j] < 0 || idx[j] >= nverts) bad_index = true;
+						}
+					}
+				});
+				if (bad_index)
+				{
+					fprintf(stderr, "Error: readPLY() face index out of range\n");
+					return false;
+				}
+			}
+			else
+			{
+				for (long long i = 0; i < e.count && p; i++)
+					p = ply_skip_record(e, p, end, swap);
+				if (!p)
+				{
+					fprintf(stderr, "Error: readPLY() truncated %s element\n", e.name.c_str());
+					return false;
+				}
+			}
+		}
+		if (face_regions && face_regions->empty())
+			face_regions->assign(mesh.num_faces(), -1);
+		return true;
+	}
+
+	/* Same callbacks as write_off_from, plus region(i) for face i, which
+	   is only called when has_regions is set. Records are assembled in a
+	   buffer and written in large blocks. */
+	template<class P, class C, class F, class R>
+	bool write_ply_from(const std::string& filename, int nverts, int nfaces, bool has_colors, bool has_regions,
+		P position, C color, F face, R region)
+	{
+		FILE* file = fopen(filename.c_str(), "wb");
+		if (!file) return false;
+
+		std::ostringstream h;
+		h << "ply\nformat binary_little_endian 1.0\n"
+		  << "element vertex " << nverts << "\n"
+		  << "property double x\nproperty double y\nproperty double z\n";
+		if (has_colors)
+			h << "property uchar red\nproperty uchar green\nproperty uchar blue\n";
+		h << "element face " << nfaces << "\n"
+		  << "property list uchar int vertex_indices\n";
+		if (has_regions)
+			h << "property int region\n";
+		h << "end_header\n";
+		std::string header = h.str();
+		bool ok = fwrite(header.data(), 1, header.size(), file) == header.size();
+
+		bool swap = !ply_host_is_little_endian();
+		const size_t BLOCK = 1 << 20;
+		std::vector<char> buf(BLOCK + 8 * 256);
+		size_t used = 0;
+		auto put = [&](const void* v, int n) {
+			const char* c = (const char*)v;
+			if (swap) for (int i = 0; i < n; i++) buf[used + i] = c[n - 1 - i];
+			else memcpy(&buf[used], c, n);
+			used += n;
+		};
+		auto flush = [&]() {
+			ok = ok && fwrite(&buf[0], 1, used, file) == used;
+			used = 0;
+		};
+
+		for (int i = 0; i < nverts && ok; i++)
+		{
+			const double* p = position(i);
+			put(p, 8); put(p + 1, 8); put(p + 2, 8);
+			if (has_colors)
+			{
+				const double* c = color(i);
+				unsigned char rgb[3] = { (unsigned char)RGB(c[0] * 255.0), (unsigned char)RGB(c[1] * 255.0), (unsigned char)RGB(c[2] * 255.0) };
+				put(rgb, 3);
+			}
+			if (used >= BLOCK) flush();
+		}
+		for (int i = 0; i < nfaces && ok; i++)
+		{
+			int n;
+			const int* v = face(i, n);
+			if (n > 255) { ok = false; break; }
+			unsigned char count = (unsigned char)n;
+			put(&count, 1);
+			for (int k = 0; k < n; k++)
+			{
+				if (used >= BLOCK) flush();
+				put(v + k, 4);
+			}
+			if (has_regions)
+			{
+				int r = region(i);
+				put(&r, 4);
+			}
+			if (used >= BLOCK) flush();
+		}
+		if (used) flush();
+
+		ok = (fclose(file) == 0) && ok;
+		return ok;
+	}
+
+	inline bool write_ply(const std::string& filename, const double* positions, int nverts,
+		const int* face_offsets, const int* face_indices, int nfaces,
+		const double* colors, const int* regions)
+	{
+		return write_ply_from(filename, nverts, nfaces, colors != NULL, regions != NULL,
+			[&](int i) { return positions + 3 * (size_t)i; },
+			[&](int i) { return colors + 3 * (size_t)i; },
+			[&](int i, int& n) {
+				int b = face_offsets ? face_offsets[i] : 3 * i;
+				n = face_offsets ? face_offsets[i+1] - b : 3;
+				return face_indices + b;
+			},
+			[&](int i) { return regions[i]; });
+	}
+
+}
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+namespace A48 {
+
+	/* Counter-based random numbers: draw i of a stream is a SplitMix64
+	   hash of the stream key and i, with no state shared between draws.
+	   Any draw can be made out of order or by any thread, so parallel
+	   code that numbers its draws gets the same values whatever the
+	   thread count, and stream() gives independent sequences for tasks
+	   or threads. The next_* calls walk the stream in order. */
+	class Rng {
+	public:
+		explicit Rng(unsigned long long seed = 0) : key_(seed), counter_(0) {}
+
+		// independent stream s of this one
+		Rng stream(unsigned long long s) const;
+
+		// draw at a given position, which leaves the counter alone
+		unsigned long long bits(unsigned long long i) const;
+		double uniform(unsigned long long i) const;   // in [0, 1), 53 bits
+
+		unsigned long long next_bits() { return bits(counter_++); }
+		double next_uniform() { return uniform(counter_++); }
+
+		// position of the next in-order draw
+		unsigned long long counter() const { return counter_; }
+		void set_counter(unsigned long long i) { counter_ = i; }
+		// reserves n draws for out-of-order use, returning the first
+		unsigned long long skip(unsigned long long n) { unsigned long long i = counter_; counter_ += n; return i; }
+
+	private:
+		static unsigned long long mix(unsigned long long z);
+
+		unsigned long long key_;
+		unsigned long long counter_;
+	};
+
+
+	/* implementation */
+
+	inline unsigned long long Rng::mix(unsigned long long z)
+	{
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+		return z ^ (z >> 31);
+	}
+
+	inline Rng Rng::stream(unsigned long long s) const
+	{
+		Rng r;
+		r.key_ = mix(key_ + (s + 1) * 0xD1B54A32D192ED03ull);
+		return r;
+	}
+
+	inline unsigned long long Rng::bits(unsigned long long i) const
+	{
+		return mix(key_ + (i + 1) * 0x9E3779B97F4A7C15ull);
+	}
+
+	inline double Rng::uniform(unsigned long long i) const
+	{
+		return (bits(i) >> 11) * (1.0 / 9007199254740992.0);
+	}
+
+}
+
+#endif
@@ -0,0 +1,362 @@
+#ifndef SEEDING_H
+#define SEEDING_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "face_buffers.h"
+#include "kdtree.h"
+#include "random.h"
+#include "thread_pool.h"
+
+namespace A48 {
+
+	enum SeedingMethod
+	{
+		SEED_WEIGHTED,         // k distinct faces drawn with probability ~ weight
+		SEED_KMEANSPP,         // k-means++: each draw ~ weight * energy to the nearest seed
+		SEED_KMEANS_PARALLEL   // k-means||: a few parallel oversampling rounds, then k-means++ on those
+	};
+
+	/* Seeds are picked in the space where the Lloyd energy of a face
+	   against a center is a squared distance: face center scaled by wc and
+	   normal by wn, see LloydCvd::update_regions_indexed. Every method
+	   returns min(k, faces) distinct face positions, and the same ones
+	   for a given rng whatever the number of threads; the draws are taken
+	   from the rng at its counter, which is moved past them. */
+	void seed_weighted(const FaceBuffers& faces, int k, Rng& rng, std::vector<int>& seeds);
+	void seed_kmeanspp(const FaceBuffers& faces, int k, double wc, double wn, Rng& rng,
+		ThreadPool* pool, std::vector<int>& seeds);
+	void seed_kmeans_parallel(const FaceBuffers& faces, int k, double wc, double wn, Rng& rng,
+		ThreadPool* pool, std::vector<int>& seeds, int rounds = 5, double oversampling = 2.0);
+
+	/* Prefix sums of non-negative weights in a Fenwick tree, so that
+	   drawing an index with probability proportional to its weight and
+	   removing it both take O(log n): sampling without replacement with
+	   no rejection loop. */
+	class WeightTree {
+	public:
+		void build(const double* w, int n);
+		double total() const { return total_; }
+		// index whose prefix range holds u, for u in [0, total())
+		int find(double u) const;
+		// sets the weight of i, which was w, to 0
+		void remove(int i, double w);
+
+	private:
+		std::vector<double> tree_;   // 1-based
+		int n_;
+		int top_;                    // highest power of 2 <= n
+		double total_;
+	};
+
+
+	/* implementation */
+
+	inline void WeightTree::build(const double* w, int n)
+	{
+		n_ = n;
+		tree_.assign(n + 1, 0.0);
+		for (int i = 1; i <= n; i++)
+		{
+			tree_[i] += std::max(w[i-1], 0.0);
+			int j = i + (i & -i);
+			if (j <= n) tree_[j] += tree_[i];
+		}
+		total_ = 0;
+		for (int i = n; i > 0; i -= i & -i)
+			total_ += tree_[i];
+		for (top_ = 1; 2 * top_ <= n; top_ *= 2) {}
+	}
+
+	inline int WeightTree::find(double u) const
+	{
+		int pos = 0;
+		for (int step = top_; step > 0; step >>= 1)
+			if (pos + step <= n_ && tree_[pos + step] <= u)
+			{
+				pos += step;
+				u -= tree_[pos];
+			}
+		return std::min(pos, n_ - 1);
+	}
+
+	inline void WeightTree::remove(int i, double w)
+	{
+		w = std::max(w, 0.0);
+		for (int j = i + 1; j <= n_; j += j & -j)
+			tree_[j] -= w;
+		total_ -= w;
+	}
+
+	/* Draws without replacement from a weight tree; zero-weight faces
+	   are only taken, in order, once the positive weight runs out. */
+	inline int seed_draw(WeightTree& tree, const double* w, std::vector<char>& taken, Rng& rng)
+	{
+		int n = (int)taken.size();
+		// the running total drifts a little as weights are removed
+		if (tree.total() > 1e-12 * (1 + fabs(tree.total())))
+			for (int tries = 0; tries < 8; tries++)
+			{
+				int i = tree.find(rng.next_uniform() * tree.total());
+				if (!taken[i] && w[i] > 0)
+					return i;
+			}
+		for (int i = 0; i < n; i++)
+			if (!taken[i])
+				return i;
+		return -1;
+	}
+
+	inline void seed_weighted(const FaceBuffers& faces, int k, Rng& rng, std::vector<int>& seeds)
+	{
+		int nf = faces.size();
+		k = std::min(k, nf);
+		seeds.clear();
+
+		WeightTree tree;
+		tree.build(faces.w.data(), nf);
+		std::vector<char> taken(nf, 0);
+		while ((int)seeds.size() < k)
+		{
+			int i = seed_draw(tree, faces.w.data(), taken, rng);
+			taken[i] = 1;
+			tree.remove(i, faces.w[i]);
+			seeds.push_back(i);
+		}
+	}
+
+	/* Energy of every face to its nearest seed, kept in min_energy and
+	   lowered by each new seed. Chunk sums are in a fixed partition and
+	   added in order, so the totals do not depend on the thread count. */
+	struct SeedEnergy {
+		enum { CHUNK = 1024 };
+
+		const FaceBuffers& faces;
+		double wc2, wn2;
+		ThreadPool* pool;
+		std::vector<double> min_energy;   // per face, times its weight in chunk_sum
+		std::vector<double> chunk_sum;
+
+		SeedEnergy(const FaceBuffers& f, double wc, double wn, ThreadPool* p)
+			: faces(f), wc2(wc * wc), wn2(wn * wn), pool(p),
+			  min_energy(f.size(), INFINITY), chunk_sum((f.size() + CHUNK - 1) / CHUNK, 0.0) {}
+
+		double energy(int a, int b) const
+		{
+			double dx = faces.cx[a] - faces.cx[b], dy = faces.cy[a] - faces.cy[b], dz = faces.cz[a] - faces.cz[b];
+			double ex = faces.nx[a] - faces.nx[b], ey = faces.ny[a] - faces.ny[b], ez = faces.nz[a] - faces.nz[b];
+			return wc2 * (dx*dx + dy*dy + dz*dz) + wn2 * (ex*ex + ey*ey + ez*ez);
+		}
+
+		double total() const
+		{
+			double t = 0;
+			for (size_t c = 0; c < chunk_sum.size(); c++) t += chunk_sum[c];
+			return t;
+		}
+
+		void add_seed(int s)
+		{
+			pool->parallel_for(faces.size(), CHUNK, [&](int begin, int end, int) {
+				double sum = 0;
+				for (int i = begin; i < end; i++)
+				{
+					min_energy[i] = std::min(min_energy[i], energy(i, s));
+					sum += faces.w[i] * min_energy[i];
+				}
+				chunk_sum[begin / CHUNK] = sum;
+			});
+		}
+
+		// face drawn with probability ~ weight * min_energy, -1 if all 0
+		int draw(double u) const
+		{
+			double t = total();
+			if (!(t > 0))
+				return -1;
+			u *= t;
+			size_t c = 0;
+			for (; c + 1 < chunk_sum.size() && u >= chunk_sum[c]; c++)
+				u -= chunk_sum[c];
+			int end = std::min((int)(c + 1) * (int)CHUNK, faces.size());
+			int last = -1;
+			for (int i = (int)c * CHUNK; i < end; i++)
+			{
+				double e = faces.w[i] * min_energy[i];
+				if (e <= 0) continue;
+				last = i;
+				if (u < e) return i;
+				u -= e;
+			}
+			return last;
+		}
+	};
+
+	inline void seed_kmeanspp(const FaceBuffers& faces, int k, double wc, double wn, Rng& rng,
+		ThreadPool* pool, std::vector<int>& seeds)
+	{
+		int nf = faces.size();
+		k = std::min(k, nf);
+		seeds.clear();
+		if (k <= 0)
+			return;
+
+		WeightTree tree;
+		tree.build(faces.w.data(), nf);
+		std::vector<char> taken(nf, 0);
+
+		SeedEnergy d(faces, wc, wn, pool);
+		int s = seed_draw(tree, faces.w.data(), taken, rng);
+		for (;;)
+		{
+			taken[s] = 1;
+			seeds.push_back(s);
+			if ((int)seeds.size() == k)
+				break;
+			d.add_seed(s);
+			s = d.draw(rng.next_uniform());
+			// faces that coincide with a seed: fall back to weight alone
+			if (s < 0 || taken[s])
+			{
+				tree.build(faces.w.data(), nf);
+				for (size_t i = 0; i < seeds.size(); i++)
+					tree.remove(seeds[i], faces.w[seeds[i]]);
+				s = seed_draw(tree, faces.w.data(), taken, rng);
+			}
+		}
+	}
+
+	/* Bahmani et al., "Scalable k-means++": each round keeps every face
+	   independently with probability oversampling * k * weight * energy /
+	   total, all of them at once in parallel. The candidates, weighted by
+	   the faces nearest to them, are then reduced to k by k-means++. */
+	inline void seed_kmeans_parallel(const FaceBuffers& faces, int k, double wc, double wn, Rng& rng,
+		ThreadPool* pool, std::vector<int>& seeds, int rounds, double oversampling)
+	{
+		int nf = faces.size();
+		k = std::min(k, nf);
+		seeds.clear();
+		if (k <= 0)
+			return;
+
+		WeightTree tree;
+		tree.build(faces.w.data(), nf);
+		std::vector<char> taken(nf, 0);
+
+		std::vector<int> candidates(1, seed_draw(tree, faces.w.data(), taken, rng));
+		taken[candidates[0]] = 1;
+
+		SeedEnergy d(faces, wc, wn, pool);
+		d.add_seed(candidates[0]);
+
+		auto key = [&](int f, double* q) {
+			q[0] = wc * faces.cx[f]; q[1] = wc * faces.cy[f]; q[2] = wc * faces.cz[f];
+			q[3] = wn * faces.nx[f]; q[4] = wn * faces.ny[f]; q[5] = wn * faces.nz[f];
+		};
+
+		std::vector<char> picked(nf);
+		std::vector<double> keys;
+		KdTree<6> index;
+		for (int r = 0; r < rounds; r++)
+		{
+			double t = d.total();
+			if (!(t > 0))
+				break;
+			double scale = oversampling * k / t;
+			unsigned long long base = rng.skip(nf);
+
+			pool->parallel_for(nf, SeedEnergy::CHUNK, [&](int begin, int end, int) {
+				for (int i = begin; i < end; i++)
+					picked[i] = !taken[i] && rng.uniform(base + i) < scale * faces.w[i] * d.min_energy[i];
+			});
+
+			keys.clear();
+			int first = (int)candidates.size();
+			for (int i = 0; i < nf; i++)
+				if (picked[i])
+				{
+					taken[i] = 1;
+					candidates.push_back(i);
+					keys.resize(keys.size() + 6);
+					key(i, &keys[keys.size() - 6]);
+				}
+			if ((int)candidates.size() == first)
+				continue;
+
+			index.build(keys);
+			pool->parallel_for(nf, SeedEnergy::CHUNK, [&](int begin, int end, int) {
+				double sum = 0;
+				for (int i = begin; i < end; i++)
+				{
+					double q[6], e;
+					key(i, q);
+					index.nearest(q, &e);
+					d.min_energy[i] = std::min(d.min_energy[i], e);
+					sum += faces.w[i] * d.min_energy[i];
+				}
+				d.chunk_sum[begin / SeedEnergy::CHUNK] = sum;
+			});
+		}
+
+		int nc = (int)candidates.size();
+		if (nc <= k)
+		{
+			// too few candidates: carry on with plain k-means++ draws
+			seeds = candidates;
+			while ((int)seeds.size() < k)
+			{
+				int s = d.draw(rng.next_uniform());
+				if (s < 0 || taken[s])
+				{
+					tree.build(faces.w.data(), nf);
+					for (size_t i = 0; i < seeds.size(); i++)
+						tree.remove(seeds[i], faces.w[seeds[i]]);
+					s = seed_draw(tree, faces.w.data(), taken, rng);
+				}
+				taken[s] = 1;
+				seeds.push_back(s);
+				d.add_seed(s);
+			}
+			return;
+		}
+
+		// weight of each candidate: the faces it is nearest to
+		keys.resize(6 * (size_t)nc);
+		for (int c = 0; c < nc; c++)
+			key(candidates[c], &keys[6 * c]);
+		index.build(keys);
+		std::vector<int> nearest(nf);
+		pool->parallel_for(nf, SeedEnergy::CHUNK, [&](int begin, int end, int) {
+			for (int i = begin; i < end; i++)
+			{
+				double q[6], e;
+				key(i, q);
+				nearest[i] = index.nearest(q, &e);
+			}
+		});
+
+		FaceBuffers reduced;
+		reduced.resize(nc);
+		for (int c = 0; c < nc; c++)
+		{
+			int f = candidates[c];
+			reduced.cx[c] = faces.cx[f]; reduced.cy[c] = faces.cy[f]; reduced.cz[c] = faces.cz[f];
+			reduced.nx[c] = faces.nx[f]; reduced.ny[c] = faces.ny[f]; reduced.nz[c] = faces.nz[f];
+			reduced.w[c] = 0;
+		}
+		for (int i = 0; i < nf; i++)
+			reduced.w[nearest[i]] += faces.w[i];
+
+		ThreadPool serial(1);
+		std::vector<int> picks;
+		Rng reduce = rng.stream(0);
+		seed_kmeanspp(reduced, k, wc, wn, reduce, &serial, picks);
+		for (int i = 0; i < k; i++)
+			seeds.push_back(candidates[picks[i]]);
+	}
+
+}
+
+#endif
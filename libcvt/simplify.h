@@ -0,0 +1,513 @@
+#ifndef SIMPLIFY_H
+#define SIMPLIFY_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "a48.h"
+
+namespace A48 {
+
+	// triangle mesh as flat arrays, one level of a hierarchy
+	struct MeshLevel {
+		std::vector<double> positions;   // 3 per vertex
+		std::vector<int> tris;           // 3 per face
+
+		int num_verts() const { return (int)positions.size() / 3; }
+		int num_faces() const { return (int)tris.size() / 3; }
+	};
+
+	/* Squared distance to a set of weighted planes as a symmetric 4x4
+	   matrix, the error metric of Garland and Heckbert. */
+	struct Quadric {
+		double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+
+		Quadric() : a2(0), ab(0), ac(0), ad(0), b2(0), bc(0), bd(0), c2(0), cd(0), d2(0) {}
+
+		// plane a x + b y + c z + d = 0 with a unit normal
+		void add_plane(double a, double b, double c, double d, double w);
+		Quadric& operator+=(const Quadric& q);
+		double eval(const double* p) const;
+	};
+
+	/* Quadric edge collapse on a triangle mesh. Edges wait in a binary
+	   heap keyed by their double cost, cheapest first and ties by index,
+	   and are updated in place as in an MxHeap, whose float keys would
+	   tie costs closer than float precision. Each collapse moves the
+	   surviving vertex to the endpoint or midpoint of least error.
+	   Collapses that would flip a face or make the surface non-manifold
+	   are skipped, and boundary edges carry extra perpendicular planes so
+	   that open borders keep their shape. */
+	class QuadricSimplifier {
+	public:
+		void init(const double* positions, int nverts, const int* tris, int nfaces);
+
+		// collapses edges until at most target faces are left; false when
+		// no valid collapse remains first
+		bool simplify(int target_faces);
+
+		int num_faces() const { return live_faces_; }
+		void extract(MeshLevel& level) const;
+
+	private:
+		enum { BOUNDARY_WEIGHT = 1000 };
+
+		struct CollapseEdge {
+			int v0, v1;
+			double target[3];
+			double cost;
+			int heap_pos;   // -1 when out of the heap
+			bool alive;
+		};
+
+		void update_cost(CollapseEdge& e);
+
+		// heap entries carry the cost to keep the sifts in the heap array
+		struct HeapEntry {
+			double cost;
+			int edge;
+
+			bool operator<(const HeapEntry& o) const
+			{
+				return (cost != o.cost) ? cost < o.cost : edge < o.edge;
+			}
+		};
+
+		void heap_place(const HeapEntry& h, int i) { heap_[i] = h; edges_[h.edge].heap_pos = i; }
+		void heap_up(int i);
+		void heap_down(int i);
+		void heap_push(int id);       // or move it after a cost change
+		void heap_remove(int id);
+		int heap_pop();
+		bool can_collapse(const CollapseEdge& e);
+		void collapse(CollapseEdge& e);
+		void face_normal(int f, int moved, const double* p, double* n) const;
+		void erase_value(std::vector<int>& v, int x) { v.erase(std::find(v.begin(), v.end(), x)); }
+
+		std::vector<double> pos_;
+		std::vector<int> tris_;
+		std::vector<char> face_alive_;
+		std::vector<char> vert_alive_;
+		std::vector<Quadric> quadric_;
+		std::vector<std::vector<int> > vfaces_;   // live faces of each vertex
+		std::vector<std::vector<int> > vedges_;   // live edges of each vertex
+		std::vector<CollapseEdge> edges_;
+		std::vector<int> mark_;                   // scratch vertex marks
+		int stamp_;
+		int live_faces_;
+		std::vector<HeapEntry> heap_;
+	};
+
+	// Coarser and coarser copies of a mesh, each with about 1/ratio of the
+	// faces of the previous one, down to coarsest_faces. levels[0] is the
+	// coarsest; the input itself is not included.
+	void build_mesh_hierarchy(const double* positions, int nverts, const int* tris, int nfaces,
+		int coarsest_faces, double ratio, std::vector<MeshLevel>& levels);
+
+
+	/* implementation */
+
+	inline void Quadric::add_plane(double a, double b, double c, double d, double w)
+	{
+		a2 += w*a*a; ab += w*a*b; ac += w*a*c; ad += w*a*d;
+		b2 += w*b*b; bc += w*b*c; bd += w*b*d;
+		c2 += w*c*c; cd += w*c*d;
+		d2 += w*d*d;
+	}
+
+	inline Quadric& Quadric::operator+=(const Quadric& q)
+	{
+		a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+		b2 += q.b2; bc += q.bc; bd += q.bd;
+		c2 += q.c2; cd += q.cd;
+		d2 += q.d2;
+		return *this;
+	}
+
+	inline double Quadric::eval(const double* p) const
+	{
+		double x = p[0], y = p[1], z = p[2];
+		return x*x*a2 + 2*x*y*ab + 2*x*z*ac + 2*x*ad
+			+ y*y*b2 + 2*y*z*bc + 2*y*bd
+			+ z*z*c2 + 2*z*cd + d2;
+	}
+
+	inline void QuadricSimplifier::init(const double* positions, int nverts, const int* tris, int nfaces)
+	{
+		pos_.assign(positions, positions + 3 * (size_t)nverts);
+		tris_.assign(tris, tris + 3 * (size_t)nfaces);
+		face_alive_.assign(nfaces, 1);
+		vert_alive_.assign(nverts, 1);
+		quadric_.assign(nverts, Quadric());
+		vfaces_.assign(nverts, std::vector<int>());
+		vedges_.assign(nverts, std::vector<int>());
+		mark_.assign(nverts, 0);
+		stamp_ = 0;
+		live_faces_ = nfaces;
+		heap_.clear();
+
+		std::vector<double> normals(3 * (size_t)nfaces);
+		for (int f = 0; f < nfaces; f++)
+		{
+			const int* t = &tris_[3*f];
+			for (int k = 0; k < 3; k++)
+				vfaces_[t[k]].push_back(f);
+
+			double* n = &normals[3*f];
+			face_normal(f, -1, 0, n);
+			double len = sqrt(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+			if (len == 0) continue;
+			n[0] /= len; n[1] /= len; n[2] /= len;
+			const double* p = &pos_[3 * t[0]];
+			double d = -(n[0]*p[0] + n[1]*p[1] + n[2]*p[2]);
+			for (int k = 0; k < 3; k++)
+				quadric_[t[k]].add_plane(n[0], n[1], n[2], d, len / 2);
+		}
+
+		// one edge per run of equal keys, as in Mesh::build
+		int nslots = 3 * nfaces;
+		std::vector<unsigned long long> keys(nslots);
+		std::vector<int> slots(nslots);
+		for (int h = 0; h < nslots; h++)
+		{
+			unsigned a = tris_[3*(h/3) + NEXT3(h%3)], b = tris_[3*(h/3) + PREV3(h%3)];
+			if (a > b) std::swap(a, b);
+			keys[h] = ((unsigned long long)a << 32) | b;
+			slots[h] = h;
+		}
+		sort_edge_keys(keys, slots);
+
+		int nedges = 0;
+		for (int i = 0; i < nslots; i++)
+			if (i == 0 || keys[i] != keys[i-1]) nedges++;
+		edges_.resize(nedges);
+
+		int e = 0;
+		for (int i = 0; i < nslots; e++)
+		{
+			int j = i + 1;
+			while (j < nslots && keys[j] == keys[i]) j++;
+
+			CollapseEdge& ce = edges_[e];
+			ce.v0 = (int)(keys[i] >> 32);
+			ce.v1 = (int)(keys[i] & 0xffffffffu);
+			ce.heap_pos = -1;
+			ce.alive = true;
+			vedges_[ce.v0].push_back(e);
+			vedges_[ce.v1].push_back(e);
+
+			if (j - i == 1)
+			{
+				// plane through the border, perpendicular to its face
+				int f = slots[i] / 3;
+				const double* p = &pos_[3 * ce.v0];
+				const double* q = &pos_[3 * ce.v1];
+				const double* n = &normals[3*f];
+				double dx = q[0] - p[0], dy = q[1] - p[1], dz = q[2] - p[2];
+				double b[3] = { dy*n[2] - dz*n[1], dz*n[0] - dx*n[2], dx*n[1] - dy*n[0] };
+				double len = sqrt(b[0]*b[0] + b[1]*b[1] + b[2]*b[2]);
+				if (len > 0)
+				{
+					b[0] /= len; b[1] /= len; b[2] /= len;
+					double d = -(b[0]*p[0] + b[1]*p[1] + b[2]*p[2]);
+					double w = BOUNDARY_WEIGHT * (dx*dx + dy*dy + dz*dz);
+					quadric_[ce.v0].add_plane(b[0], b[1], b[2], d, w);
+					quadric_[ce.v1].add_plane(b[0], b[1], b[2], d, w);
+				}
+			}
+			i = j;
+		}
+
+		heap_.reserve(nedges);
+		for (int i = 0; i < nedges; i++)
+		{
+			update_cost(edges_[i]);
+			heap_push(i);
+		}
+	}
+
+	inline void QuadricSimplifier::heap_up(int i)
+	{
+		HeapEntry h = heap_[i];
+		while (i > 0 && h < heap_[(i - 1) / 2])
+		{
+			heap_place(heap_[(i - 1) / 2], i);
+			i = (i - 1) / 2;
+		}
+		heap_place(h, i);
+	}
+
+	inline void QuadricSimplifier::heap_down(int i)
+	{
+		int n = (int)heap_.size();
+		HeapEntry h = heap_[i];
+		for (;;)
+		{
+			int c = 2 * i + 1;
+			if (c >= n) break;
+			if (c + 1 < n && heap_[c + 1] < heap_[c]) c++;
+			if (!(heap_[c] < h)) break;
+			heap_place(heap_[c], i);
+			i = c;
+		}
+		heap_place(h, i);
+	}
+
+	inline void QuadricSimplifier::heap_push(int id)
+	{
+		CollapseEdge& e = edges_[id];
+		HeapEntry h = { e.cost, id };
+		int i = e.heap_pos;
+		if (i < 0)
+		{
+			heap_.push_back(h);
+			heap_up((int)heap_.size() - 1);
+			return;
+		}
+		heap_[i] = h;
+		heap_up(i);
+		heap_down(e.heap_pos);
+	}
+
+	inline void QuadricSimplifier::heap_remove(int id)
+	{
+		int i = edges_[id].heap_pos;
+		if (i < 0) return;
+		edges_[id].heap_pos = -1;
+		HeapEntry last = heap_.back();
+		heap_.pop_back();
+		if (last.edge == id) return;
+		heap_place(last, i);
+		heap_up(i);
+		heap_down(edges_[last.edge].heap_pos);
+	}
+
+	inline int QuadricSimplifier::heap_pop()
+	{
+		if (heap_.empty()) return -1;
+		int id = heap_[0].edge;
+		heap_remove(id);
+		return id;
+	}
+
+	inline void QuadricSimplifier::update_cost(CollapseEdge& e)
+	{
+		Quadric q = quadric_[e.v0];
+		q += quadric_[e.v1];
+
+		const double* p0 = &pos_[3 * e.v0];
+		const double* p1 = &pos_[3 * e.v1];
+		double mid[3] = { (p0[0] + p1[0]) / 2, (p0[1] + p1[1]) / 2, (p0[2] + p1[2]) / 2 };
+		const double* candidates[3] = { p0, p1, mid };
+
+		double best = INF;
+		for (int k = 0; k < 3; k++)
+		{
+			double c = q.eval(candidates[k]);
+			if (c < best)
+			{
+				best = c;
+				std::copy(candidates[k], candidates[k] + 3, e.target);
+			}
+		}
+		e.cost = std::max(best, 0.0);
+	}
+
+	// normal of face f, with vertex moved at p when moved >= 0
+	inline void QuadricSimplifier::face_normal(int f, int moved, const double* p, double* n) const
+	{
+		const double* v[3];
+		for (int k = 0; k < 3; k++)
+			v[k] = (tris_[3*f + k] == moved) ? p : &pos_[3 * tris_[3*f + k]];
+		double a[3] = { v[1][0] - v[0][0], v[1][1] - v[0][1], v[1][2] - v[0][2] };
+		double b[3] = { v[2][0] - v[0][0], v[2][1] - v[0][1], v[2][2] - v[0][2] };
+		n[0] = a[1]*b[2] - a[2]*b[1];
+		n[1] = a[2]*b[0] - a[0]*b[2];
+		n[2] = a[0]*b[1] - a[1]*b[0];
+	}
+
+	/* The link condition, so that the surface stays a manifold: the two
+	   endpoints share no neighbour besides the third corners of the faces
+	   along the edge. Then no remaining face may flip or degenerate. */
+	inline bool QuadricSimplifier::can_collapse(const CollapseEdge& e)
+	{
+		int shared_faces = 0, common = 0;
+		stamp_++;
+		for (size_t i = 0; i < vfaces_[e.v0].size(); i++)
+		{
+			const int* t = &tris_[3 * vfaces_[e.v0][i]];
+			for (int k = 0; k < 3; k++) mark_[t[k]] = stamp_;
+		}
+		for (size_t i = 0; i < vfaces_[e.v1].size(); i++)
+		{
+			const int* t = &tris_[3 * vfaces_[e.v1][i]];
+			bool has_v0 = (t[0] == e.v0 || t[1] == e.v0 || t[2] == e.v0);
+			if (has_v0) shared_faces++;
+			for (int k = 0; k < 3; k++)
+				if (t[k] != e.v0 && t[k] != e.v1 && mark_[t[k]] == stamp_)
+				{
+					mark_[t[k]] = -stamp_;   // count once
+					common++;
+				}
+		}
+		if (shared_faces == 0 || common != shared_faces)
+			return false;
+
+		for (int s = 0; s < 2; s++)
+		{
+			int v = s ? e.v1 : e.v0, other = s ? e.v0 : e.v1;
+			for (size_t i = 0; i < vfaces_[v].size(); i++)
+			{
+				int f = vfaces_[v][i];
+				const int* t = &tris_[3*f];
+				if (t[0] == other || t[1] == other || t[2] == other)
+					continue;
+				double n0[3], n1[3];
+				face_normal(f, -1, 0, n0);
+				face_normal(f, v, e.target, n1);
+				double dot = n0[0]*n1[0] + n0[1]*n1[1] + n0[2]*n1[2];
+				double l0 = n0[0]*n0[0] + n0[1]*n0[1] + n0[2]*n0[2];
+				double l1 = n1[0]*n1[0] + n1[1]*n1[1] + n1[2]*n1[2];
+				if (l1 <= 1e-12 * l0 || dot <= 0.1 * sqrt(l0 * l1))
+					return false;
+			}
+		}
+		return true;
+	}
+
+	/* v1 goes into v0: faces along the edge die, the others of v1 move to
+	   v0, and edges of v1 either move to v0 or, when v0 already has one to
+	   the same vertex, die. */
+	inline void QuadricSimplifier::collapse(CollapseEdge& e)
+	{
+		int v0 = e.v0, v1 = e.v1;
+		std::copy(e.target, e.target + 3, &pos_[3 * v0]);
+		quadric_[v0] += quadric_[v1];
+
+		for (size_t i = 0; i < vfaces_[v1].size(); i++)
+		{
+			int f = vfaces_[v1][i];
+			int* t = &tris_[3*f];
+			if (t[0] == v0 || t[1] == v0 || t[2] == v0)
+			{
+				face_alive_[f] = 0;
+				live_faces_--;
+				for (int k = 0; k < 3; k++)
+					if (t[k] != v1) erase_value(vfaces_[t[k]], f);
+			}
+			else
+			{
+				for (int k = 0; k < 3; k++)
+					if (t[k] == v1) t[k] = v0;
+				vfaces_[v0].push_back(f);
+			}
+		}
+
+		e.alive = false;
+		erase_value(vedges_[v0], (int)(&e - &edges_[0]));
+		stamp_++;
+		for (size_t i = 0; i < vedges_[v0].size(); i++)
+		{
+			const CollapseEdge& g = edges_[vedges_[v0][i]];
+			mark_[g.v0 == v0 ? g.v1 : g.v0] = stamp_;
+		}
+		for (size_t i = 0; i < vedges_[v1].size(); i++)
+		{
+			int id = vedges_[v1][i];
+			CollapseEdge& g = edges_[id];
+			if (&g == &e)
+				continue;
+			int u = (g.v0 == v1) ? g.v1 : g.v0;
+			if (mark_[u] == stamp_)
+			{
+				g.alive = false;
+				heap_remove(id);
+				erase_value(vedges_[u], id);
+			}
+			else
+			{
+				if (g.v0 == v1) g.v0 = v0; else g.v1 = v0;
+				vedges_[v0].push_back(id);
+				mark_[u] = stamp_;
+			}
+		}
+
+		vfaces_[v1].clear();
+		vedges_[v1].clear();
+		vert_alive_[v1] = 0;
+
+		for (size_t i = 0; i < vedges_[v0].size(); i++)
+		{
+			int id = vedges_[v0][i];
+			update_cost(edges_[id]);
+			heap_push(id);
+		}
+	}
+
+	inline bool QuadricSimplifier::simplify(int target_faces)
+	{
+		while (live_faces_ > target_faces)
+		{
+			int id = heap_pop();
+			if (id < 0)
+				return false;
+			// an edge that cannot collapse stays out of the heap until a
+			// neighbouring collapse updates it
+			CollapseEdge& e = edges_[id];
+			if (e.alive && can_collapse(e))
+				collapse(e);
+		}
+		return true;
+	}
+
+	inline void QuadricSimplifier::extract(MeshLevel& level) const
+	{
+		std::vector<int> remap(vert_alive_.size(), -1);
+		level.positions.clear();
+		level.tris.clear();
+		level.tris.reserve(3 * (size_t)live_faces_);
+		for (size_t f = 0; f < face_alive_.size(); f++)
+		{
+			if (!face_alive_[f])
+				continue;
+			for (int k = 0; k < 3; k++)
+			{
+				int v = tris_[3*f + k];
+				if (remap[v] < 0)
+				{
+					remap[v] = level.num_verts();
+					level.positions.insert(level.positions.end(), &pos_[3*v], &pos_[3*v] + 3);
+				}
+				level.tris.push_back(remap[v]);
+			}
+		}
+	}
+
+	inline void build_mesh_hierarchy(const double* positions, int nverts, const int* tris, int nfaces,
+		int coarsest_faces, double ratio, std::vector<MeshLevel>& levels)
+	{
+		levels.clear();
+		if (nfaces <= coarsest_faces || ratio <= 1)
+			return;
+
+		QuadricSimplifier s;
+		s.init(positions, nverts, tris, nfaces);
+		for (double target = nfaces / ratio; ; target /= ratio)
+		{
+			int t = std::max((int)target, coarsest_faces);
+			bool more = s.simplify(t);
+			if (levels.empty() || s.num_faces() < levels.back().num_faces())
+			{
+				levels.push_back(MeshLevel());
+				s.extract(levels.back());
+			}
+			if (!more || t == coarsest_faces)
+				break;
+		}
+		std::reverse(levels.begin(), levels.end());
+	}
+
+}
+
+#endif
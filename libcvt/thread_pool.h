@@ -0,0 +1,137 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+namespace A48 {
+
+	/* Fixed set of worker threads running parallel loops. The calling
+	   thread takes part in every loop as thread 0, so a pool of size 1
+	   has no workers and runs everything inline. */
+	class ThreadPool {
+	public:
+		explicit ThreadPool(int threads = 1);
+		~ThreadPool();
+
+		int size() const { return (int)workers_.size() + 1; }
+
+		// Calls f(begin, end, thread) over [0, n) in chunks of the given size.
+		template<class F>
+		void parallel_for(int n, int chunk, F f);
+
+	private:
+		ThreadPool(const ThreadPool&);
+		ThreadPool& operator=(const ThreadPool&);
+
+		template<class F>
+		static void invoke(void* f, int begin, int end, int thread)
+		{ (*(F*)f)(begin, end, thread); }
+
+		void worker_loop(int id);
+		void run_chunks(int id);
+
+		std::vector<std::thread> workers_;
+		std::mutex m_;
+		std::condition_variable start_cv_;
+		std::condition_variable done_cv_;
+
+		// current job, type-erased without allocating
+		void (*invoke_)(void*, int, int, int);
+		void* job_;
+		int n_, chunk_;
+		std::atomic<int> next_;
+		int pending_;          // workers still running the current job
+		unsigned generation_;  // bumped for every new job
+		bool quit_;
+	};
+
+
+	/* implementation */
+
+	inline ThreadPool::ThreadPool(int threads)
+		: invoke_(0), job_(0), n_(0), chunk_(1), next_(0), pending_(0), generation_(0), quit_(false)
+	{
+		if (threads <= 0)
+			threads = (int)std::thread::hardware_concurrency();
+		for (int i = 1; i < threads; i++)
+			workers_.push_back(std::thread(&ThreadPool::worker_loop, this, i));
+	}
+
+	inline ThreadPool::~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_);
+			quit_ = true;
+		}
+		start_cv_.notify_all();
+		for (size_t i = 0; i < workers_.size(); i++)
+			workers_[i].join();
+	}
+
+	template<class F>
+	void ThreadPool::parallel_for(int n, int chunk, F f)
+	{
+		if (chunk < 1) chunk = 1;
+
+		if (workers_.empty() || n <= chunk)
+		{
+			for (int b = 0; b < n; b += chunk)
+				f(b, (b + chunk < n)? b + chunk : n, 0);
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_);
+			invoke_ = &ThreadPool::invoke<F>;
+			job_ = &f;
+			n_ = n;
+			chunk_ = chunk;
+			next_ = 0;
+			pending_ = (int)workers_.size();
+			generation_++;
+		}
+		start_cv_.notify_all();
+
+		run_chunks(0);
+
+		std::unique_lock<std::mutex> lock(m_);
+		while (pending_ > 0) done_cv_.wait(lock);
+		job_ = 0;
+	}
+
+	inline void ThreadPool::run_chunks(int id)
+	{
+		for (;;)
+		{
+			int b = next_.fetch_add(chunk_);
+			if (b >= n_) break;
+			invoke_(job_, b, (b + chunk_ < n_)? b + chunk_ : n_, id);
+		}
+	}
+
+	inline void ThreadPool::worker_loop(int id)
+	{
+		unsigned seen = 0;
+		for (;;)
+		{
+			{
+				std::unique_lock<std::mutex> lock(m_);
+				while (!quit_ && generation_ == seen) start_cv_.wait(lock);
+				if (quit_) return;
+				seen = generation_;
+			}
+
+			run_chunks(id);
+
+			std::lock_guard<std::mutex> lock(m_);
+			if (--pending_ == 0) done_cv_.notify_one();
+		}
+	}
+
+}
+
+#endif